@@ -15,25 +15,56 @@
  */
 
 #include <QDebug>
+#include <QSettings>
 #include "hvac.h"
+#include "hvaczonemodel.h"
 #include "vehiclesignals.h"
 
 
+// Writes from e.g. a slider being dragged are coalesced, with at most
+// one set per signal sent per interval (ms) and the last value always
+// sent at the end.
+#define HVAC_WRITE_INTERVAL	100
+
+// Placeholder for a server value not known yet
+#define UNKNOWN_VALUE		-1000
+
+#define DEFAULT_TEMPERATURE	21
+#define DEFAULT_MIN_TEMPERATURE	-50
+#define DEFAULT_MAX_TEMPERATURE	50
+// The fan speed is presented as 0-255, VSS uses a 0-100 percentage
+#define DEFAULT_MAX_FAN_SPEED	255
+#define VSS_MAX_FAN_SPEED	100
+
 // TODO: don't duplicate defaults from HVAC service here
 HVAC::HVAC(VehicleSignals *vs, QObject * parent) :
 	QObject(parent),
 	m_vs(vs),
 	m_connected(false),
-	m_fanspeed(0),
-	m_temp_left_zone(21),
-	m_temp_right_zone(21)
+	m_fanspeed(-1),
+	m_temp_left_zone(-1),
+	m_temp_right_zone(-1)
 {
+	loadZones();
+	m_model = new HVACZoneModel(this, this);
+
+	m_write_timer.setSingleShot(true);
+	m_write_timer.setInterval(HVAC_WRITE_INTERVAL);
+	QObject::connect(&m_write_timer, &QTimer::timeout, this, &HVAC::flushWrites);
+
 	QObject::connect(m_vs, &VehicleSignals::connected, this, &HVAC::onConnected);
 	QObject::connect(m_vs, &VehicleSignals::authorized, this, &HVAC::onAuthorized);
 	QObject::connect(m_vs, &VehicleSignals::disconnected, this, &HVAC::onDisconnected);
 
-	if (m_vs)
-		m_vs->connect();
+	if (!m_vs)
+		return;
+
+	for (int i = 0; i < m_controls.size(); i++) {
+		m_vs->addSignalHandler(m_controls[i].path, this,
+				       [this, i](const QVariant &value, const QString &) { updateFromServer(i, value); });
+	}
+
+	m_vs->connect();
 }
 
 HVAC::~HVAC()
@@ -41,45 +72,272 @@ HVAC::~HVAC()
 	delete m_vs;
 }
 
+QAbstractListModel *HVAC::zones() const
+{
+	return m_model;
+}
+
+// Zones are described as an array in the "hvac" configuration file,
+// e.g. for a second row with a single zone:
+//
+// [zones]
+// size=3
+// 1\row=1
+// 1\side=Left
+// ...
+// 3\row=2
+// 3\side=Middle
+// 3\name=Rear
+// 3\fan-speed=false
+// 3\temperature-min=16
+// 3\temperature-max=28
+//
+// The VSS paths default to Vehicle.Cabin.HVAC.Station.Row<row>.<side>,
+// and can be overridden with temperature-path and fan-speed-path.
+// Temperatures are sent as is unless temperature-vss-min and
+// temperature-vss-max give a different range for the signal.
+void HVAC::loadZones()
+{
+	QSettings settings("AGL", "hvac");
+
+	int size = settings.beginReadArray("zones");
+	for (int i = 0; i < size; i++) {
+		settings.setArrayIndex(i);
+
+		Zone zone;
+		zone.row = settings.value("row", 0).toInt();
+		zone.side = settings.value("side").toString();
+		if (zone.row <= 0 || zone.side.isEmpty()) {
+			qWarning() << "HVAC: ignoring zone" << i + 1 << "without row or side";
+			continue;
+		}
+		zone.name = settings.value("name", QString("Row%1 %2").arg(zone.row).arg(zone.side)).toString();
+		zone.temperature = -1;
+		zone.fanSpeed = -1;
+
+		QString prefix = QString("Vehicle.Cabin.HVAC.Station.Row%1.%2.").arg(zone.row).arg(zone.side);
+		int index = m_zones.size();
+		m_zones.append(zone);
+
+		if (settings.value("temperature", true).toBool()) {
+			int min = settings.value("temperature-min", DEFAULT_MIN_TEMPERATURE).toInt();
+			int max = settings.value("temperature-max", DEFAULT_MAX_TEMPERATURE).toInt();
+			int vssMin = settings.value("temperature-vss-min", min).toInt();
+			int vssMax = settings.value("temperature-vss-max", max).toInt();
+			m_zones[index].temperature =
+				addControl(Temperature, index,
+					   settings.value("temperature-path", prefix + "Temperature").toString(),
+					   DEFAULT_TEMPERATURE, min, max, vssMin, vssMax);
+		}
+		if (settings.value("fan-speed", true).toBool()) {
+			int max = settings.value("fan-speed-max", DEFAULT_MAX_FAN_SPEED).toInt();
+			m_zones[index].fanSpeed =
+				addControl(FanSpeed, index,
+					   settings.value("fan-speed-path", prefix + "FanSpeed").toString(),
+					   0, 0, max, 0, VSS_MAX_FAN_SPEED);
+		}
+	}
+	settings.endArray();
+
+	if (m_zones.isEmpty())
+		addDefaultZones();
+
+	m_fanspeed = findControl(FanSpeed, 1, "Left");
+	m_temp_left_zone = findControl(Temperature, 1, "Left");
+	m_temp_right_zone = findControl(Temperature, 1, "Right");
+}
+
+void HVAC::addDefaultZones()
+{
+	m_zones.append({ "Row1 Left", 1, "Left", -1, -1 });
+	m_zones[0].temperature = addControl(Temperature, 0,
+					    "Vehicle.Cabin.HVAC.Station.Row1.Left.Temperature",
+					    DEFAULT_TEMPERATURE,
+					    DEFAULT_MIN_TEMPERATURE, DEFAULT_MAX_TEMPERATURE,
+					    DEFAULT_MIN_TEMPERATURE, DEFAULT_MAX_TEMPERATURE);
+	m_zones[0].fanSpeed = addControl(FanSpeed, 0,
+					 "Vehicle.Cabin.HVAC.Station.Row1.Left.FanSpeed",
+					 0, 0, DEFAULT_MAX_FAN_SPEED, 0, VSS_MAX_FAN_SPEED);
+
+	m_zones.append({ "Row1 Right", 1, "Right", -1, -1 });
+	m_zones[1].temperature = addControl(Temperature, 1,
+					    "Vehicle.Cabin.HVAC.Station.Row1.Right.Temperature",
+					    DEFAULT_TEMPERATURE,
+					    DEFAULT_MIN_TEMPERATURE, DEFAULT_MAX_TEMPERATURE,
+					    DEFAULT_MIN_TEMPERATURE, DEFAULT_MAX_TEMPERATURE);
+}
+
+int HVAC::addControl(ControlType type, int zone, const QString &path,
+		     int value, int min, int max, int vssMin, int vssMax)
+{
+	if (max < min)
+		qSwap(min, max);
+	if (value < min)
+		value = min;
+	else if (value > max)
+		value = max;
+
+	m_controls.append({ path, value, UNKNOWN_VALUE, false, 0, type, zone, min, max, vssMin, vssMax });
+	return m_controls.size() - 1;
+}
+
+int HVAC::findControl(ControlType type, int row, const QString &side) const
+{
+	for (const Zone &zone : m_zones) {
+		if (zone.row == row && zone.side == side)
+			return type == Temperature ? zone.temperature : zone.fanSpeed;
+	}
+	return -1;
+}
+
+int HVAC::controlValue(int index) const
+{
+	return index >= 0 ? m_controls[index].value : 0;
+}
+
+int HVAC::toVss(int index, int value) const
+{
+	const Control &control = m_controls[index];
+
+	// Make sure value is within range
+	if (value > control.max)
+		value = control.max;
+	else if (value < control.min)
+		value = control.min;
+
+	if (control.min == control.vssMin && control.max == control.vssMax)
+		return value;
+	if (control.max == control.min)
+		return control.vssMin;
+	return control.vssMin + qRound((value - control.min) * double(control.vssMax - control.vssMin) /
+				       (control.max - control.min));
+}
+
+int HVAC::fromVss(int index, int value) const
+{
+	const Control &control = m_controls[index];
+
+	if (control.min != control.vssMin || control.max != control.vssMax) {
+		if (control.vssMax == control.vssMin)
+			return control.min;
+		value = control.min + qRound((value - control.vssMin) * double(control.max - control.min) /
+					     (control.vssMax - control.vssMin));
+	}
+
+	if (value > control.max)
+		value = control.max;
+	else if (value < control.min)
+		value = control.min;
+	return value;
+}
+
 void HVAC::set_fanspeed(int speed)
+{
+	setControl(m_fanspeed, speed);
+}
+
+void HVAC::set_temp_left_zone(int temp)
+{
+	setControl(m_temp_left_zone, temp);
+}
+
+void HVAC::set_temp_right_zone(int temp)
+{
+	setControl(m_temp_right_zone, temp);
+}
+
+bool HVAC::setControl(int index, int value)
+{
+	if (!(m_vs && m_connected) || index < 0)
+		return false;
+
+	// Apply optimistically, the server is written to on the trailing
+	// edge of the write interval.
+	Control &control = m_controls[index];
+	if (value > control.max)
+		value = control.max;
+	else if (value < control.min)
+		value = control.min;
+	if (control.value != value) {
+		control.value = value;
+		notifyChanged(index);
+	}
+	control.dirty = true;
+	if (!m_write_timer.isActive())
+		m_write_timer.start();
+	return true;
+}
+
+void HVAC::flushWrites()
 {
 	if (!(m_vs && m_connected))
 		return;
 
-	// Scale incoming 0-255 speed to 0-100 to match VSS signal
-	double value = (speed % 256) * 100.0 / 255.0;
-	m_vs->set("Vehicle.Cabin.HVAC.Station.Row1.Left.FanSpeed", QString::number((int) (value + 0.5)));
-	emit fanSpeedChanged(speed);
+	for (int i = 0; i < m_controls.size(); i++) {
+		Control &control = m_controls[i];
+		if (!control.dirty)
+			continue;
+		control.dirty = false;
+
+		int value = toVss(i, control.value);
+		if (value == control.serverValue && !control.inFlight)
+			continue;
+
+		control.inFlight++;
+		m_vs->set(control.path, value, [this, i](const VehicleSignalsResponse &response) {
+			writeCompleted(i, response.success);
+		});
+	}
 }
 
-void HVAC::set_temp_left_zone(int temp)
+void HVAC::writeCompleted(int index, bool success)
 {
-	if (!(m_vs && m_connected))
+	Control &control = m_controls[index];
+	if (control.inFlight)
+		control.inFlight--;
+	if (success || control.dirty || control.inFlight)
 		return;
 
-	// Make sure value is within VSS signal range
-	int value = temp;
-	if (value > 50)
-		value = 50;
-	else if (value < -50)
-		value = -50;
-	m_vs->set("Vehicle.Cabin.HVAC.Station.Row1.Left.Temperature", QString::number(value));
-	emit leftTemperatureChanged(temp);
+	// Rejected, fall back to what the server has
+	qWarning() << "HVAC: setting" << control.path << "failed";
+	if (control.serverValue != UNKNOWN_VALUE && toVss(index, control.value) != control.serverValue) {
+		control.value = fromVss(index, control.serverValue);
+		notifyChanged(index);
+	}
 }
 
-void HVAC::set_temp_right_zone(int temp)
+void HVAC::updateFromServer(int index, const QVariant &value)
 {
-	if (!(m_vs && m_connected))
+	bool ok = false;
+	int serverValue = qRound(value.toDouble(&ok));
+	if (!ok)
 		return;
 
-	// Make sure value is within VSS signal range
-	int value = temp;
-	if (value > 50)
-		value = 50;
-	else if (value < -50)
-		value = -50;
-	m_vs->set("Vehicle.Cabin.HVAC.Station.Row1.Right.Temperature", QString::number(value));
-	emit rightTemperatureChanged(temp);
+	Control &control = m_controls[index];
+	control.serverValue = serverValue;
+
+	// Local writes still on their way win, the server catches up
+	if (control.dirty || control.inFlight)
+		return;
+
+	// Only adopt actual changes, scaling is lossy for the fan speed
+	if (toVss(index, control.value) != serverValue) {
+		control.value = fromVss(index, serverValue);
+		notifyChanged(index);
+	}
+}
+
+void HVAC::notifyChanged(int index)
+{
+	int value = m_controls[index].value;
+	if (index == m_fanspeed)
+		emit fanSpeedChanged(value);
+	else if (index == m_temp_left_zone)
+		emit leftTemperatureChanged(value);
+	else if (index == m_temp_right_zone)
+		emit rightTemperatureChanged(value);
+
+	m_model->controlChanged(index);
 }
 
 void HVAC::onConnected()
@@ -95,13 +353,30 @@ void HVAC::onAuthorized()
 	if (!m_vs)
 		return;
 
-	// Could subscribe and connect notification signal here to monitor
-	// external updates...
-
 	m_connected = true;
+
+	// Track external changes, and sync up with the current state
+	QStringList paths;
+	for (int i = 0; i < m_controls.size(); i++)
+		paths.append(m_controls[i].path);
+	m_vs->subscribeMany(paths);
+
+	for (int i = 0; i < m_controls.size(); i++) {
+		m_vs->get(m_controls[i].path, [this, i](const VehicleSignalsResponse &response) {
+			if (response.success)
+				updateFromServer(i, response.value);
+		});
+	}
 }
 
 void HVAC::onDisconnected()
 {
 	m_connected = false;
+
+	// Nothing is in flight anymore, any pending writes are dropped
+	m_write_timer.stop();
+	for (int i = 0; i < m_controls.size(); i++) {
+		m_controls[i].dirty = false;
+		m_controls[i].inFlight = 0;
+	}
 }
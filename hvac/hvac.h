@@ -19,11 +19,15 @@
 
 #include <memory>
 #include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QAbstractListModel>
 #include <QJsonArray>
 #include <QtQml/QQmlContext>
 #include <QtQml/QQmlListProperty>
 
 class VehicleSignals;
+class HVACZoneModel;
 
 class HVAC : public QObject
 {
@@ -32,11 +36,17 @@ class HVAC : public QObject
 	Q_PROPERTY(int fanSpeed READ get_fanspeed WRITE set_fanspeed NOTIFY fanSpeedChanged)
 	Q_PROPERTY(int leftTemperature READ get_temp_left_zone WRITE set_temp_left_zone NOTIFY leftTemperatureChanged)
 	Q_PROPERTY(int rightTemperature READ get_temp_right_zone WRITE set_temp_right_zone NOTIFY rightTemperatureChanged)
+	Q_PROPERTY(QAbstractListModel *zones READ zones CONSTANT)
 
 public:
+	// The zone table is read from the "hvac" AGL configuration file
+	// (e.g. /etc/xdg/AGL/hvac.conf), see loadZones() for the format.
+	// Without one, the Row1 Left/Right zones are used.
 	explicit HVAC(VehicleSignals *vs, QObject * parent = Q_NULLPTR);
         virtual ~HVAC();
 
+	QAbstractListModel *zones() const;
+
 signals:
         void fanSpeedChanged(int fanSpeed);
         void leftTemperatureChanged(int temp);
@@ -47,22 +57,81 @@ private slots:
 	void onConnected();
 	void onAuthorized();
 	void onDisconnected();
+	void flushWrites();
 
 private:
+	friend class HVACZoneModel;
+
 	VehicleSignals *m_vs;
 	bool m_connected;
 
-        int m_fanspeed;
-        int m_temp_left_zone;
-        int m_temp_right_zone;
+	enum ControlType {
+		Temperature,
+		FanSpeed
+	};
+
+	// Cached state of an HVAC signal.  value (in property units) is
+	// what is presented, i.e. the latest local write, or else the
+	// last value seen from the server.  serverValue is in VSS units,
+	// -1000 if not known yet.  Property values in min..max are
+	// scaled linearly to vssMin..vssMax.
+	struct Control {
+		QString path;
+		int value;
+		int serverValue;
+		// Local write waiting for the write timer
+		bool dirty;
+		// Writes sent and not completed yet
+		unsigned int inFlight;
+		ControlType type;
+		int zone;
+		int min;
+		int max;
+		int vssMin;
+		int vssMax;
+	};
+
+	// Zone, with indexes of its controls in m_controls (-1 if none)
+	struct Zone {
+		QString name;
+		int row;
+		QString side;
+		int temperature;
+		int fanSpeed;
+	};
 
-        int get_fanspeed() const { return m_fanspeed; };
-        int get_temp_left_zone() const { return m_temp_left_zone; };
-        int get_temp_right_zone() const { return m_temp_right_zone; };
+	// All controls of all zones, zones refer to them by index
+	QVector<Control> m_controls;
+	QVector<Zone> m_zones;
+	HVACZoneModel *m_model;
+	QTimer m_write_timer;
+
+	// Controls backing the Row1 properties, -1 if not configured
+	int m_fanspeed;
+	int m_temp_left_zone;
+	int m_temp_right_zone;
+
+	int get_fanspeed() const { return controlValue(m_fanspeed); };
+	int get_temp_left_zone() const { return controlValue(m_temp_left_zone); };
+	int get_temp_right_zone() const { return controlValue(m_temp_right_zone); };
 
         void set_fanspeed(int speed);
         void set_temp_left_zone(int temp);
         void set_temp_right_zone(int temp);
+
+	void loadZones();
+	void addDefaultZones();
+	int addControl(ControlType type, int zone, const QString &path,
+		       int value, int min, int max, int vssMin, int vssMax);
+	int findControl(ControlType type, int row, const QString &side) const;
+	int controlValue(int index) const;
+
+	int toVss(int index, int value) const;
+	int fromVss(int index, int value) const;
+	bool setControl(int index, int value);
+	void updateFromServer(int index, const QVariant &value);
+	void writeCompleted(int index, bool success);
+	void notifyChanged(int index);
 };
 
 #endif // HVAC_H
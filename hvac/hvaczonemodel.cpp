@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hvaczonemodel.h"
+#include "hvac.h"
+
+HVACZoneModel::HVACZoneModel(HVAC *hvac, QObject *parent) :
+	QAbstractListModel(parent),
+	m_hvac(hvac)
+{
+}
+
+int HVACZoneModel::rowCount(const QModelIndex &parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return m_hvac->m_zones.count();
+}
+
+QVariant HVACZoneModel::data(const QModelIndex &index, int role) const
+{
+	if (index.row() < 0 || index.row() >= m_hvac->m_zones.count())
+		return QVariant();
+
+	const HVAC::Zone &zone = m_hvac->m_zones[index.row()];
+	const HVAC::Control *temperature = zone.temperature >= 0 ? &m_hvac->m_controls[zone.temperature] : nullptr;
+	const HVAC::Control *fanSpeed = zone.fanSpeed >= 0 ? &m_hvac->m_controls[zone.fanSpeed] : nullptr;
+
+	switch (role) {
+	case NameRole:
+		return zone.name;
+	case RowRole:
+		return zone.row;
+	case SideRole:
+		return zone.side;
+	case HasTemperatureRole:
+		return temperature != nullptr;
+	case TemperatureRole:
+		return temperature ? temperature->value : QVariant();
+	case MinTemperatureRole:
+		return temperature ? temperature->min : QVariant();
+	case MaxTemperatureRole:
+		return temperature ? temperature->max : QVariant();
+	case HasFanSpeedRole:
+		return fanSpeed != nullptr;
+	case FanSpeedRole:
+		return fanSpeed ? fanSpeed->value : QVariant();
+	case MinFanSpeedRole:
+		return fanSpeed ? fanSpeed->min : QVariant();
+	case MaxFanSpeedRole:
+		return fanSpeed ? fanSpeed->max : QVariant();
+	}
+
+	return QVariant();
+}
+
+bool HVACZoneModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+	if (index.row() < 0 || index.row() >= m_hvac->m_zones.count())
+		return false;
+
+	const HVAC::Zone &zone = m_hvac->m_zones[index.row()];
+	int control = -1;
+	if (role == TemperatureRole)
+		control = zone.temperature;
+	else if (role == FanSpeedRole)
+		control = zone.fanSpeed;
+	if (control < 0)
+		return false;
+
+	bool ok = false;
+	int v = value.toInt(&ok);
+	if (!ok)
+		return false;
+
+	// dataChanged is emitted via controlChanged if the value changes,
+	// nothing is changed while there is no connection to write to.
+	return m_hvac->setControl(control, v);
+}
+
+Qt::ItemFlags HVACZoneModel::flags(const QModelIndex &index) const
+{
+	if (!index.isValid() || index.row() < 0 || index.row() >= m_hvac->m_zones.count())
+		return Qt::NoItemFlags;
+	return QAbstractListModel::flags(index) | Qt::ItemIsEditable;
+}
+
+void HVACZoneModel::controlChanged(int control)
+{
+	const HVAC::Control &c = m_hvac->m_controls[control];
+	QModelIndex idx = index(c.zone);
+	if (c.type == HVAC::Temperature)
+		emit dataChanged(idx, idx, { TemperatureRole });
+	else
+		emit dataChanged(idx, idx, { FanSpeedRole });
+}
+
+QHash<int, QByteArray> HVACZoneModel::roleNames() const
+{
+	QHash<int, QByteArray> roles;
+	roles[NameRole] = "name";
+	roles[RowRole] = "row";
+	roles[SideRole] = "side";
+	roles[HasTemperatureRole] = "hasTemperature";
+	roles[TemperatureRole] = "temperature";
+	roles[MinTemperatureRole] = "minTemperature";
+	roles[MaxTemperatureRole] = "maxTemperature";
+	roles[HasFanSpeedRole] = "hasFanSpeed";
+	roles[FanSpeedRole] = "fanSpeed";
+	roles[MinFanSpeedRole] = "minFanSpeed";
+	roles[MaxFanSpeedRole] = "maxFanSpeed";
+
+	return roles;
+}
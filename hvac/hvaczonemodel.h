@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HVAC_ZONE_MODEL_H
+#define HVAC_ZONE_MODEL_H
+
+#include <QAbstractListModel>
+
+class HVAC;
+
+// Read/write view of the HVAC zones for QML.  The state itself lives
+// in HVAC, writes to the temperature and fanSpeed roles go through the
+// same optimistic update and write coalescing as the HVAC properties.
+
+class HVACZoneModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+public:
+	enum ZoneRoles {
+		NameRole = Qt::UserRole + 1,
+		RowRole,
+		SideRole,
+		HasTemperatureRole,
+		TemperatureRole,
+		MinTemperatureRole,
+		MaxTemperatureRole,
+		HasFanSpeedRole,
+		FanSpeedRole,
+		MinFanSpeedRole,
+		MaxFanSpeedRole
+	};
+
+	explicit HVACZoneModel(HVAC *hvac, QObject *parent = Q_NULLPTR);
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+	bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+	Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+	void controlChanged(int control);
+
+protected:
+	QHash<int, QByteArray> roleNames() const override;
+
+private:
+	HVAC *m_hvac;
+};
+
+#endif // HVAC_ZONE_MODEL_H
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+
+#include "AlbumArtCache.h"
+
+// On disk, each entry is a file named after its key containing
+//
+// <MIME type>\n<song modification time>\n<image data>
+
+AlbumArtCache::AlbumArtCache(int memoryLimit, int diskLimit) :
+	m_cache(memoryLimit),
+	m_disk_limit(qint64(diskLimit) * 1024),
+	m_disk_size(-1)
+{
+	QString base = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+	if (base.isEmpty())
+		return;
+
+	m_dir = base + "/qtappfw/albumart";
+	if (!QDir().mkpath(m_dir)) {
+		qWarning() << "Could not create album art cache directory" << m_dir;
+		m_dir.clear();
+	}
+}
+
+QString AlbumArtCache::key(const QString &uri, const QString &album)
+{
+	// Songs of an album normally live in the same directory and
+	// share their art, key on both to not mix up albums of the same
+	// name.
+	QByteArray id;
+	if (album.isEmpty())
+		id = "uri:" + uri.toUtf8();
+	else
+		id = "album:" + QFileInfo(uri).path().toUtf8() + '\n' + album.toUtf8();
+
+	return QString::fromLatin1(QCryptographicHash::hash(id, QCryptographicHash::Sha1).toHex());
+}
+
+bool AlbumArtCache::find(const QString &key, qint64 modified, AlbumArt &art)
+{
+	Entry *entry = m_cache.object(key);
+	if (entry) {
+		if (entry->art.modified < modified)
+			return false;
+		art = entry->art;
+		return true;
+	}
+
+	Entry *disk = new Entry;
+	if (!readFile(key, *disk) || disk->art.modified < modified) {
+		delete disk;
+		return false;
+	}
+	art = disk->art;
+	m_cache.insert(key, disk, disk->art.data.size() / 1024 + 1);
+	return true;
+}
+
+void AlbumArtCache::insert(const QString &key, qint64 modified, const AlbumArt &art)
+{
+	Entry *entry = new Entry{ art };
+	entry->art.modified = modified;
+
+	// Songs without art are only remembered in memory
+	if (!art.type.isEmpty())
+		writeFile(key, *entry);
+
+	m_cache.insert(key, entry, entry->art.data.size() / 1024 + 1);
+}
+
+void AlbumArtCache::clear()
+{
+	m_cache.clear();
+}
+
+bool AlbumArtCache::readFile(const QString &key, Entry &entry)
+{
+	if (m_dir.isEmpty())
+		return false;
+
+	QFile file(m_dir + "/" + key);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QByteArray type = file.readLine().trimmed();
+	bool ok = false;
+	qint64 modified = file.readLine().trimmed().toLongLong(&ok);
+	QByteArray data = file.readAll();
+	if (type.isEmpty() || !ok || data.isEmpty()) {
+		qWarning() << "Removing corrupt album art cache entry" << key;
+		file.remove();
+		return false;
+	}
+
+	entry.art.type = QString::fromLatin1(type);
+	entry.art.data = data;
+	entry.art.modified = modified;
+	return true;
+}
+
+void AlbumArtCache::writeFile(const QString &key, const Entry &entry)
+{
+	if (m_dir.isEmpty())
+		return;
+
+	QSaveFile file(m_dir + "/" + key);
+	if (!file.open(QIODevice::WriteOnly))
+		return;
+
+	file.write(entry.art.type.toLatin1() + '\n');
+	file.write(QByteArray::number(entry.art.modified) + '\n');
+	file.write(entry.art.data);
+	if (!file.commit()) {
+		qWarning() << "Could not write album art cache entry" << key;
+		return;
+	}
+
+	if (m_disk_size >= 0)
+		m_disk_size += entry.art.data.size();
+	pruneDisk();
+}
+
+void AlbumArtCache::pruneDisk()
+{
+	if (m_disk_size >= 0 && m_disk_size <= m_disk_limit)
+		return;
+
+	// Oldest first
+	QDir dir(m_dir);
+	QFileInfoList files = dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+	m_disk_size = 0;
+	for (const QFileInfo &info : files)
+		m_disk_size += info.size();
+	if (m_disk_size <= m_disk_limit)
+		return;
+
+	// Go down to 3/4 of the limit so this does not run on every insert
+	for (const QFileInfo &info : files) {
+		if (m_disk_size <= m_disk_limit * 3 / 4)
+			break;
+		if (QFile::remove(info.filePath()))
+			m_disk_size -= info.size();
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALBUM_ART_CACHE_H
+#define ALBUM_ART_CACHE_H
+
+#include <QCache>
+#include <QString>
+#include <QByteArray>
+
+// Limits in KB
+#define ALBUM_ART_MEMORY_LIMIT	(32 * 1024)
+#define ALBUM_ART_DISK_LIMIT	(64 * 1024)
+
+struct AlbumArt
+{
+	// MIME type, empty if the song is known to have no art
+	QString type;
+	QByteArray data;
+	// Last modification time of the song the art was read from
+	qint64 modified = 0;
+};
+
+// Album art fetched from MPD, kept in a bounded LRU in memory and in a
+// bounded directory on disk so that it survives restarts.  Art is
+// looked up per album (or per song if the album is not known), with
+// entries invalidated when a song newer than the one the art was read
+// from comes along.
+//
+// Not thread safe, use from one thread only.
+
+class AlbumArtCache
+{
+public:
+	AlbumArtCache(int memoryLimit = ALBUM_ART_MEMORY_LIMIT, int diskLimit = ALBUM_ART_DISK_LIMIT);
+
+	static QString key(const QString &uri, const QString &album);
+
+	// modified is the last modification time of the song (seconds
+	// since the epoch), entries for older files are not returned.
+	bool find(const QString &key, qint64 modified, AlbumArt &art);
+	void insert(const QString &key, qint64 modified, const AlbumArt &art);
+
+	// Drop what is in memory, e.g. after a database update
+	void clear();
+
+private:
+	struct Entry {
+		AlbumArt art;
+	};
+
+	QCache<QString, Entry> m_cache;
+	QString m_dir;
+	qint64 m_disk_limit;
+	// -1 until the directory has been scanned
+	qint64 m_disk_size;
+
+	bool readFile(const QString &key, Entry &entry);
+	void writeFile(const QString &key, const Entry &entry);
+	void pruneDisk();
+};
+
+#endif // ALBUM_ART_CACHE_H
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <cstring>
+#include <cstdlib>
+#include "AlbumArtFetcher.h"
+#include "AlbumArtProvider.h"
+
+// Give up on a stalled read rather than hanging the art thread
+#define ALBUM_ART_CONNECTION_TIMEOUT	10000
+
+AlbumArtFetcher::AlbumArtFetcher(QObject *parent) :
+	QObject(parent)
+{
+}
+
+AlbumArtFetcher::~AlbumArtFetcher()
+{
+	closeConnection();
+}
+
+void AlbumArtFetcher::request(const QVariantMap &track, qint64 modified)
+{
+	QMutexLocker locker(&m_mutex);
+
+	// Player events also come in for pause, seek, etc., those should
+	// not abandon reading the current song's art.
+	if (track.value("path") != m_track.value("path"))
+		m_generation.fetchAndAddOrdered(1);
+
+	m_track = track;
+	m_modified = modified;
+	if (m_pending)
+		return;
+	m_pending = true;
+	locker.unlock();
+
+	QMetaObject::invokeMethod(this, "fetch", Qt::QueuedConnection);
+}
+
+void AlbumArtFetcher::cancel(void)
+{
+	QMutexLocker locker(&m_mutex);
+
+	m_generation.fetchAndAddOrdered(1);
+	m_track.clear();
+	m_pending = false;
+}
+
+void AlbumArtFetcher::clearCache(void)
+{
+	m_art_cache.clear();
+}
+
+bool AlbumArtFetcher::isCancelled(unsigned generation)
+{
+	return m_generation.loadAcquire() != generation;
+}
+
+bool AlbumArtFetcher::openConnection(void)
+{
+	if (m_mpd_conn)
+		return true;
+
+	struct mpd_connection *conn = mpd_connection_new(NULL, 0, ALBUM_ART_CONNECTION_TIMEOUT);
+	if (!conn) {
+		qWarning() << "Could not create MPD connection for album art";
+		return false;
+	}
+	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS) {
+		qWarning() << "MPD connection for album art failed:"
+			   << mpd_connection_get_error_message(conn);
+		mpd_connection_free(conn);
+		return false;
+	}
+	m_mpd_conn = conn;
+	m_binary_limit_set = false;
+	return true;
+}
+
+void AlbumArtFetcher::closeConnection(void)
+{
+	if (m_mpd_conn) {
+		mpd_connection_free(m_mpd_conn);
+		m_mpd_conn = Q_NULLPTR;
+	}
+}
+
+void AlbumArtFetcher::fetch(void)
+{
+	QMutexLocker locker(&m_mutex);
+	if (!m_pending)
+		return;
+	m_pending = false;
+	QVariantMap track = m_track;
+	qint64 modified = m_modified;
+	unsigned generation = m_generation.loadAcquire();
+	locker.unlock();
+
+	QString uri = track.value("path").toString();
+	QString album = track.value("album").toString();
+	if (uri.isEmpty())
+		return;
+
+	// Art is shared by an album, but a song without art is only
+	// remembered as such on its own.
+	QString key = AlbumArtCache::key(uri, album);
+	QString song_key = album.isEmpty() ? key : AlbumArtCache::key(uri, QString());
+	AlbumArt art;
+	if (!m_art_cache.find(key, modified, art) &&
+	    !m_art_cache.find(song_key, modified, art)) {
+		QByteArray buffer;
+		QString mime_type;
+		bool found = false;
+		// MPD drops connections that sit idle for too long, so a
+		// failure on an old connection is retried on a new one.
+		for (int attempt = 0; attempt < 2 && !found; attempt++) {
+			bool reused = m_mpd_conn != Q_NULLPTR;
+			if (!openConnection())
+				return;
+			found = getSongArt(uri, buffer, mime_type, generation);
+			if (isCancelled(generation) || !reused || m_mpd_conn)
+				break;
+		}
+		if (isCancelled(generation))
+			return;
+		if (found) {
+			if (mime_type.size()) {
+				art.type = mime_type;
+				art.data = buffer;
+				art.modified = modified;
+				m_art_cache.insert(key, modified, art);
+			} else {
+				m_art_cache.insert(song_key, modified, art);
+			}
+		}
+	}
+
+	// The UI gets an image provider URL rather than the image
+	// itself, the id changes if the art does so that the QML
+	// image cache does not hand out stale art.
+	QString id = key + "-" + QString::number(art.modified);
+	if (!art.type.size())
+		return;
+
+	// A skipped song must not take over the art kept as current
+	if (isCancelled(generation) || !AlbumArtProvider::setCurrent(id, art.data))
+		return;
+
+	// Decoding takes a while, check again
+	if (isCancelled(generation))
+		return;
+
+	track["image"] = AlbumArtProvider::url(id);
+	QVariantMap metadata;
+	metadata["track"] = track;
+	emit metadataUpdate(metadata);
+}
+
+
+// Ask MPD for larger binary chunks than its 8 KB default, so that
+// typical covers come in one or a few responses.
+void AlbumArtFetcher::setBinaryLimit(void)
+{
+	if (m_binary_limit_set)
+		return;
+	m_binary_limit_set = true;
+
+	// binarylimit was added in MPD 0.22.4
+	if (mpd_connection_cmp_server_version(m_mpd_conn, 0, 22, 4) < 0)
+		return;
+
+	QByteArray limit = QByteArray::number(MPD_BINARY_LIMIT);
+	if (!mpd_send_command(m_mpd_conn, "binarylimit", limit.constData(), NULL) ||
+	    !mpd_response_finish(m_mpd_conn)) {
+		qWarning() << "MPD binarylimit failed";
+		mpd_connection_clear_error(m_mpd_conn);
+	}
+}
+
+// Reads the pairs of a readpicture response up to the binary data.
+// chunk is the size of the binary data following, or -1 if there is
+// no picture.
+bool AlbumArtFetcher::recvPictureHeader(unsigned &size, QString &type, int &chunk)
+{
+	size = 0;
+	chunk = -1;
+
+	struct mpd_pair *pair;
+	while ((pair = mpd_recv_pair(m_mpd_conn)) != NULL) {
+		if (!strcmp(pair->name, "size"))
+			size = strtoul(pair->value, NULL, 10);
+		else if (!strcmp(pair->name, "type"))
+			type = QString(pair->value);
+		else if (!strcmp(pair->name, "binary"))
+			chunk = strtol(pair->value, NULL, 10);
+		mpd_return_pair(m_mpd_conn, pair);
+
+		if (chunk >= 0)
+			return true;
+	}
+
+	return mpd_connection_get_error(m_mpd_conn) == MPD_ERROR_SUCCESS;
+}
+
+bool AlbumArtFetcher::getSongArt(const QString &path, QByteArray &buffer, QString &type, unsigned generation)
+{
+	buffer.clear();
+	type.clear();
+
+	setBinaryLimit();
+
+	QByteArray path_ba = path.toUtf8();
+	const char *path_cstr = path_ba.constData();
+
+	// The first chunk gives the size, which is then received into
+	// directly.
+	unsigned pic_size = 0;
+	int chunk = -1;
+	// Cleared when bailing out with a response partly unread
+	bool in_sync = true;
+	if (!mpd_send_command(m_mpd_conn, "readpicture", path_cstr, "0", NULL) ||
+	    !recvPictureHeader(pic_size, type, chunk))
+		goto error;
+
+	if (chunk < 0 || pic_size == 0) {
+		// No art, an empty binary still has to be read
+		char unused;
+		type.clear();
+		if (chunk > 0) {
+			in_sync = false;
+			goto error;
+		}
+		if (chunk == 0 && !mpd_recv_binary(m_mpd_conn, &unused, 0))
+			goto error;
+		return mpd_response_finish(m_mpd_conn);
+	}
+	if ((unsigned) chunk > pic_size) {
+		in_sync = false;
+		goto error;
+	}
+
+	buffer.resize(pic_size);
+	if (!mpd_recv_binary(m_mpd_conn, buffer.data(), chunk) ||
+	    !mpd_response_finish(m_mpd_conn))
+		goto error;
+
+	// Older servers do not always know
+	if (type.isEmpty())
+		type = "application/octet-stream";
+
+	{
+		unsigned pic_offset = chunk;
+		while (pic_offset < pic_size) {
+			if (isCancelled(generation))
+				goto error;
+
+			// Request the rest in batches, assuming the server keeps
+			// sending chunks of the first one's size.
+			int requests = 0;
+			if (!mpd_command_list_begin(m_mpd_conn, true))
+				goto error;
+			for (unsigned offset = pic_offset;
+			     offset < pic_size && requests < MPD_READPICTURE_PIPELINE;
+			     offset += chunk, requests++) {
+				QByteArray offset_ba = QByteArray::number(offset);
+				if (!mpd_send_command(m_mpd_conn, "readpicture", path_cstr, offset_ba.constData(), NULL))
+					goto error;
+			}
+			if (!mpd_command_list_end(m_mpd_conn))
+				goto error;
+
+			unsigned expected = pic_offset;
+			int next_chunk = chunk;
+			for (int i = 0; i < requests; i++) {
+				unsigned size = 0;
+				QString unused;
+				int received = -1;
+				if (!recvPictureHeader(size, unused, received))
+					goto error;
+				if (received < 0 || size != pic_size) {
+					in_sync = false;
+					goto error;
+				}
+
+				// Anything past a short chunk is re-requested with
+				// the size the server actually uses, but still has
+				// to be read to keep the connection in sync.
+				unsigned offset = pic_offset + i * chunk;
+				bool ok;
+				if (offset == expected && offset + received <= pic_size) {
+					ok = mpd_recv_binary(m_mpd_conn, buffer.data() + offset, received);
+					expected += received;
+				} else {
+					QByteArray discard(received, Qt::Uninitialized);
+					ok = mpd_recv_binary(m_mpd_conn, discard.data(), received);
+				}
+				if (!ok || !mpd_response_next(m_mpd_conn))
+					goto error;
+
+				if (received > 0 && received < chunk && offset + received < pic_size)
+					next_chunk = received;
+			}
+			if (!mpd_response_finish(m_mpd_conn) || expected == pic_offset)
+				goto error;
+
+			pic_offset = expected;
+			chunk = next_chunk;
+		}
+	}
+
+	return true;
+
+error:
+	// Don't pass garbage to caller
+	buffer.clear();
+	type.clear();
+
+	// Server errors (e.g. a missing file) leave the connection usable,
+	// anything else means starting over on a new one.
+	if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS &&
+	    !mpd_connection_clear_error(m_mpd_conn)) {
+		qWarning() << "MPD connection error reading album art:"
+			   << mpd_connection_get_error_message(m_mpd_conn);
+		closeConnection();
+	} else if (!in_sync) {
+		// Binary data or further list responses are still pending,
+		// the next command would read them as its reply.
+		qWarning() << "Unexpected MPD readpicture response for" << path;
+		closeConnection();
+	}
+	return false;
+}
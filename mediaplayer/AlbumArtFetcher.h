@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALBUM_ART_FETCHER_H
+#define ALBUM_ART_FETCHER_H
+
+#include <QObject>
+#include <QVariant>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <mpd/client.h>
+#include "AlbumArtCache.h"
+
+// Album art is read in chunks of up to MPD_BINARY_LIMIT bytes, with up
+// to MPD_READPICTURE_PIPELINE requests in flight.  Keep the product well
+// under MPD's default 8 MB max_output_buffer_size.
+#define MPD_BINARY_LIMIT		(256 * 1024)
+#define MPD_READPICTURE_PIPELINE	8
+
+// Reads album art on its own MPD connection, meant to live in its own
+// thread so that large covers do not hold up the event handler.  Only
+// the latest request matters: a request replaces any still pending,
+// and a fetch in progress is abandoned once another song is asked for.
+// The art is sent as a follow up track metadata update.
+
+class AlbumArtFetcher : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit AlbumArtFetcher(QObject *parent = Q_NULLPTR);
+	virtual ~AlbumArtFetcher();
+
+	// Thread safe.  track is the current song's metadata as sent to
+	// the UI, modified its last modification time.
+	void request(const QVariantMap &track, qint64 modified);
+	void cancel(void);
+
+public slots:
+	// Drop what is in memory, e.g. after a database update
+	void clearCache(void);
+
+signals:
+	void metadataUpdate(QVariantMap metadata);
+
+private slots:
+	void fetch(void);
+
+private:
+	bool openConnection(void);
+	void closeConnection(void);
+	bool isCancelled(unsigned generation);
+
+	bool getSongArt(const QString &path, QByteArray &buffer, QString &type, unsigned generation);
+	bool recvPictureHeader(unsigned &size, QString &type, int &chunk);
+	void setBinaryLimit(void);
+
+	// Latest request, protected by m_mutex
+	QMutex m_mutex;
+	QVariantMap m_track;
+	qint64 m_modified = 0;
+	bool m_pending = false;
+
+	// Bumped whenever the song asked for changes
+	QAtomicInteger<unsigned> m_generation;
+
+	struct mpd_connection *m_mpd_conn = Q_NULLPTR;
+	bool m_binary_limit_set = false;
+	AlbumArtCache m_art_cache;
+};
+
+#endif // ALBUM_ART_FETCHER_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include "AlbumArtProvider.h"
+
+// Decoded images kept, in KB.  Only the current art is normally in use,
+// the rest avoids decoding again when going back and forth in a queue.
+#define DECODED_LIMIT	(16 * 1024)
+
+// Sizes kept per image
+#define MAX_SCALED	4
+
+QMutex AlbumArtProvider::s_mutex;
+QCache<QString, AlbumArtProvider::Entry> AlbumArtProvider::s_images(DECODED_LIMIT);
+QString AlbumArtProvider::s_current_id;
+QImage AlbumArtProvider::s_current;
+
+AlbumArtProvider::AlbumArtProvider() :
+	// Scaling happens in requestImage, keep it off the GUI thread
+	QQuickImageProvider(QQuickImageProvider::Image, QQmlImageProviderBase::ForceAsynchronousImageLoading)
+{
+}
+
+QImage AlbumArtProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
+{
+	QMutexLocker locker(&s_mutex);
+
+	Entry *entry = findEntry(id);
+	if (!entry)
+		return QImage();
+
+	QImage image = entry->image;
+	if (size)
+		*size = image.size();
+
+	int width = requestedSize.width();
+	int height = requestedSize.height();
+	if ((width <= 0 && height <= 0) || image.isNull())
+		return image;
+
+	// A missing dimension follows the aspect ratio
+	if (width <= 0)
+		width = image.width() * height / image.height();
+	else if (height <= 0)
+		height = image.height() * width / image.width();
+
+	QSize target = image.size().scaled(width, height, Qt::KeepAspectRatio);
+	if (target == image.size())
+		return image;
+
+	quint64 key = quint64(target.width()) << 32 | quint64(target.height());
+	auto it = entry->scaled.constFind(key);
+	if (it != entry->scaled.constEnd())
+		return it.value();
+
+	// Scale without holding the lock, other requests can go on
+	locker.unlock();
+	QImage scaled = image.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+	locker.relock();
+
+	// The entry may have been evicted in the meantime
+	entry = s_images.object(id);
+	if (entry && entry->image.cacheKey() == image.cacheKey()) {
+		if (entry->scaled.size() >= MAX_SCALED)
+			entry->scaled.clear();
+		entry->scaled.insert(key, scaled);
+	}
+	return scaled;
+}
+
+bool AlbumArtProvider::setCurrent(const QString &id, const QByteArray &data)
+{
+	QImage image;
+	{
+		QMutexLocker locker(&s_mutex);
+		if (Entry *entry = findEntry(id))
+			image = entry->image;
+	}
+
+	// Decode without holding the lock
+	if (image.isNull() && !image.loadFromData(data)) {
+		qWarning() << "Could not decode album art";
+		return false;
+	}
+
+	QMutexLocker locker(&s_mutex);
+	if (!s_images.contains(id)) {
+		Entry *entry = new Entry;
+		entry->image = image;
+		s_images.insert(id, entry, image.sizeInBytes() / 1024 + 1);
+	}
+	s_current_id = id;
+	s_current = image;
+	return true;
+}
+
+AlbumArtProvider::Entry *AlbumArtProvider::findEntry(const QString &id)
+{
+	Entry *entry = s_images.object(id);
+	if (entry || id != s_current_id || s_current.isNull())
+		return entry;
+
+	// The current art was evicted, put it back
+	entry = new Entry;
+	entry->image = s_current;
+	if (!s_images.insert(id, entry, s_current.sizeInBytes() / 1024 + 1))
+		return Q_NULLPTR;
+	return entry;
+}
+
+QString AlbumArtProvider::url(const QString &id)
+{
+	return QStringLiteral("image://" ALBUM_ART_PROVIDER_ID "/") + id;
+}
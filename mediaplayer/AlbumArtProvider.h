@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALBUM_ART_PROVIDER_H
+#define ALBUM_ART_PROVIDER_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QQuickImageProvider>
+
+#define ALBUM_ART_PROVIDER_ID	"albumart"
+
+// Serves decoded album art to QML as image://albumart/<id>.  Images
+// are decoded once when added, by whichever thread fetched the art,
+// and scaled to each size QML asks for once.  The images are shared
+// by all engines in the process.  The current art is always served,
+// even once it has been evicted to make room for others.
+
+class AlbumArtProvider : public QQuickImageProvider
+{
+public:
+	AlbumArtProvider();
+
+	QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override;
+
+	// Makes id the current art, decoding data unless the image is
+	// still around.  Returns false if it cannot be decoded.
+	static bool setCurrent(const QString &id, const QByteArray &data);
+	static QString url(const QString &id);
+
+private:
+	struct Entry {
+		QImage image;
+		// Scaled copies, keyed by size
+		QHash<quint64, QImage> scaled;
+	};
+
+	// Called with s_mutex held
+	static Entry *findEntry(const QString &id);
+
+	static QMutex s_mutex;
+	static QCache<QString, Entry> s_images;
+	static QString s_current_id;
+	static QImage s_current;
+};
+
+#endif // ALBUM_ART_PROVIDER_H
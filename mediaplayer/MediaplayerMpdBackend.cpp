@@ -266,6 +266,14 @@ void MediaplayerMpdBackend::updateMetadata(QVariantMap metadata)
 
 	if (metadata.contains("track")) {
 		QVariantMap track = metadata.value("track").toMap();
+
+		// Art comes from its own thread, drop it if the song has
+		// changed in the meantime.
+		if (!metadata.contains("status") && track.contains("image")) {
+			QVariantMap cached_track = m_cached_metadata.value("track").toMap();
+			if (cached_track.value("path") != track.value("path"))
+				return;
+		}
 		m_cached_metadata["track"] = track;
 	}
 
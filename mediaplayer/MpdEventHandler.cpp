@@ -17,6 +17,7 @@
 #include <QDebug>
 #include <QFileInfo>
 #include <QThread>
+#include <QSet>
 #include "MpdEventHandler.h"
 
 MpdEventHandler::MpdEventHandler(QObject *parent) :
@@ -33,10 +34,29 @@ MpdEventHandler::MpdEventHandler(QObject *parent) :
 		qFatal("%s", mpd_connection_get_error_message(conn));
 	}
 	m_mpd_conn = conn;
+
+	// Album art is read on its own connection and thread.  Our own
+	// thread sits in mpd_run_idle_mask and never runs its event loop,
+	// so the art updates are forwarded directly from the art thread,
+	// the backend's connection then queues them to its thread.
+	m_art_fetcher = new AlbumArtFetcher();
+	m_art_fetcher->moveToThread(&m_art_thread);
+	connect(&m_art_thread, &QThread::finished, m_art_fetcher, &QObject::deleteLater);
+	connect(m_art_fetcher,
+		&AlbumArtFetcher::metadataUpdate,
+		this,
+		&MpdEventHandler::metadataUpdate,
+		Qt::DirectConnection);
+	m_art_thread.start();
 }
 
 MpdEventHandler::~MpdEventHandler()
 {
+	// Abandon any fetch in progress rather than wait for it
+	m_art_fetcher->cancel();
+	m_art_thread.quit();
+	m_art_thread.wait();
+
 	mpd_connection_free(m_mpd_conn);
 }
 
@@ -80,67 +100,241 @@ void MpdEventHandler::handleDatabaseEvent(void)
 	if(!mpd_run_add(m_mpd_conn, "/")) {
 		qWarning() << "mpd_run_add failed";
 	}
+
+	// Songs may have been replaced, recheck against the disk cache
+	QMetaObject::invokeMethod(m_art_fetcher, "clearCache", Qt::QueuedConnection);
+}
+
+// Metadata for a queue entry as sent to the UI
+static QVariantMap queueTrack(const struct mpd_song *song)
+{
+	QString title(mpd_song_get_tag(song, MPD_TAG_TITLE, 0));
+	QString artist(mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
+	QString album(mpd_song_get_tag(song, MPD_TAG_ALBUM, 0));
+	QString genre(mpd_song_get_tag(song, MPD_TAG_GENRE, 0));
+	QString uri(mpd_song_get_uri(song));
+	int pos = mpd_song_get_pos(song);
+
+	if (title.isEmpty()) {
+		// If there's no tag, use the filename
+		QFileInfo fi(uri);
+		title = fi.fileName();
+	}
+
+	//qDebug() << "Queue[" << pos << "]: " << artist << " - " << title << " / " << album << ", genre " << genre;
+
+	QVariantMap track;
+	track["title"] = title;
+	track["artist"] = artist;
+	track["album"] = album;
+	track["genre"] = genre;
+	track["index"] = pos;
+	track["duration"] = mpd_song_get_duration_ms(song);
+	track["path"] = uri;
+	track["id"] = mpd_song_get_id(song);
+	return track;
 }
 
 void MpdEventHandler::handleQueueEvent(void)
+{
+	// Only send what changed since the last version seen, falling back
+	// to reading the whole queue if that is not possible.
+	if (m_queue_valid && updateQueue())
+		return;
+
+	m_queue_valid = loadQueue();
+}
+
+// Clears server errors so the idle loop can go on, other errors are
+// left for it to see.
+void MpdEventHandler::queueError(void)
+{
+	if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS &&
+	    !mpd_connection_clear_error(m_mpd_conn))
+		qWarning() << "MPD connection error reading queue:"
+			   << mpd_connection_get_error_message(m_mpd_conn);
+}
+
+bool MpdEventHandler::loadQueue(void)
 {
 	QVariantList playlist;
-	bool done = false;
-	struct mpd_entity *entity;
-	mpd_send_list_queue_meta(m_mpd_conn);
-	do {
-		entity = mpd_recv_entity(m_mpd_conn);
-		if (!entity) {
-			enum mpd_error error = mpd_connection_get_error(m_mpd_conn);
-			if (error == MPD_ERROR_SUCCESS)
-				done = true;
-			break;
-		}
-		if (mpd_entity_get_type(entity) != MPD_ENTITY_TYPE_SONG) {
-			mpd_entity_free(entity);
-			continue;
-		}
-		const struct mpd_song *song = mpd_entity_get_song(entity);
-		QString title(mpd_song_get_tag(song, MPD_TAG_TITLE, 0));
-		QString artist(mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
-		QString album(mpd_song_get_tag(song, MPD_TAG_ALBUM, 0));
-		QString genre(mpd_song_get_tag(song, MPD_TAG_GENRE, 0));
-		QString uri(mpd_song_get_uri(song));
-		int pos = mpd_song_get_pos(song);
+	QVector<unsigned> ids;
+	struct mpd_song *song;
+
+	// The status is read in the same command list so that its version
+	// matches the queue contents.
+	if (!mpd_command_list_begin(m_mpd_conn, true) ||
+	    !mpd_send_status(m_mpd_conn) ||
+	    !mpd_send_list_queue_meta(m_mpd_conn) ||
+	    !mpd_command_list_end(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
 
-		if (title.isEmpty()) {
-			// If there's no tag, use the filename
-			QFileInfo fi(uri);
-			title = fi.fileName();
-		}
+	struct mpd_status *status = mpd_recv_status(m_mpd_conn);
+	if (!status) {
+		queueError();
+		return false;
+	}
+	unsigned version = mpd_status_get_queue_version(status);
+	mpd_status_free(status);
+	if (!mpd_response_next(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
 
-		//qDebug() << "Queue[" << pos << "]: " << artist << " - " << title << " / " << album << ", genre " << genre;
+	while ((song = mpd_recv_song(m_mpd_conn)) != NULL) {
+		playlist.append(queueTrack(song));
+		ids.append(mpd_song_get_id(song));
+		mpd_song_free(song);
+	}
+	if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS ||
+	    !mpd_response_finish(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
 
-		QVariantMap track;
-		track["title"] = title;
-		track["artist"] = artist;
-		track["album"] = album;
-		track["genre"] = genre;
-		track["index"] = pos;
-		track["duration"] = mpd_song_get_duration_ms(song);
-		track["path"] = uri;
-		playlist.append(track);
+	m_queue_version = version;
+	m_queue_ids = ids;
+
+	QVariantMap metadata;
+	metadata["list"] = playlist;
+	emit playlistUpdate(metadata);
+	return true;
+}
+
+bool MpdEventHandler::updateQueue(void)
+{
+	unsigned version;
+	unsigned length;
+	unsigned pos, id;
+	QVector<QPair<unsigned, unsigned>> changes;
+
+	// plchangesposid gives the song id at each position that changed,
+	// songs already in the queue need no metadata to be moved.
+	if (!mpd_command_list_begin(m_mpd_conn, true) ||
+	    !mpd_send_status(m_mpd_conn) ||
+	    !mpd_send_queue_changes_brief(m_mpd_conn, m_queue_version) ||
+	    !mpd_command_list_end(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
+
+	struct mpd_status *status = mpd_recv_status(m_mpd_conn);
+	if (!status) {
+		queueError();
+		return false;
+	}
+	version = mpd_status_get_queue_version(status);
+	length = mpd_status_get_queue_length(status);
+	mpd_status_free(status);
+	if (!mpd_response_next(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
 
-		mpd_entity_free(entity);
-	} while(!done);
+	while (mpd_recv_queue_change_brief(m_mpd_conn, &pos, &id))
+		changes.append(qMakePair(pos, id));
+	if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS ||
+	    !mpd_response_finish(m_mpd_conn)) {
+		queueError();
+		return false;
+	}
 
-	if (done) {
-		QVariantMap metadata;
-		metadata["list"] = playlist;
+	QSet<unsigned> known;
+	for (unsigned old_id : m_queue_ids)
+		known.insert(old_id);
+
+	unsigned old_length = m_queue_ids.size();
+	QVector<unsigned> ids = m_queue_ids;
+	ids.resize(length);
+	QVector<bool> filled(length, false);
+	QVariantList positions;
+	QVariantList change_ids;
+	QVector<unsigned> fetch;
+	for (const auto &change : changes) {
+		if (change.first >= length)
+			continue;
+		// New songs and songs changed in place (e.g. retagged) need
+		// their metadata.
+		if (!known.contains(change.second) ||
+		    (change.first < old_length && m_queue_ids[change.first] == change.second))
+			fetch.append(change.second);
+		ids[change.first] = change.second;
+		filled[change.first] = true;
+		positions.append(change.first);
+		change_ids.append(change.second);
+	}
+	for (unsigned i = old_length; i < length; i++) {
+		if (!filled[i])
+			return false;
+	}
 
-		emit playlistUpdate(metadata);
+	if (version == m_queue_version || (positions.isEmpty() && length == old_length)) {
+		m_queue_version = version;
+		return true;
 	}
+
+	// Not worth it for large changes, e.g. a new queue
+	if (fetch.size() > MPD_QUEUE_FETCH_BATCH && (unsigned) fetch.size() > length / 2)
+		return false;
+
+	QVariantList tracks;
+	for (int i = 0; i < fetch.size(); i += MPD_QUEUE_FETCH_BATCH) {
+		int count = qMin(MPD_QUEUE_FETCH_BATCH, fetch.size() - i);
+		if (!mpd_command_list_begin(m_mpd_conn, true)) {
+			queueError();
+			return false;
+		}
+		for (int j = 0; j < count; j++) {
+			if (!mpd_send_get_queue_song_id(m_mpd_conn, fetch[i + j])) {
+				queueError();
+				return false;
+			}
+		}
+		if (!mpd_command_list_end(m_mpd_conn)) {
+			queueError();
+			return false;
+		}
+
+		// A song removed since plchangesposid fails the list, the
+		// next queue event will have caught up.
+		for (int j = 0; j < count; j++) {
+			struct mpd_song *song = mpd_recv_song(m_mpd_conn);
+			if (!song) {
+				queueError();
+				return false;
+			}
+			tracks.append(queueTrack(song));
+			mpd_song_free(song);
+			if (!mpd_response_next(m_mpd_conn)) {
+				queueError();
+				return false;
+			}
+		}
+		if (!mpd_response_finish(m_mpd_conn)) {
+			queueError();
+			return false;
+		}
+	}
+
+	m_queue_version = version;
+	m_queue_ids = ids;
+
+	QVariantMap metadata;
+	metadata["length"] = length;
+	metadata["positions"] = positions;
+	metadata["ids"] = change_ids;
+	metadata["tracks"] = tracks;
+	emit playlistUpdate(metadata);
+	return true;
 }
 
 void MpdEventHandler::handlePlayerEvent(void)
 {
 	int pos = -1;
 	QString uri;
+	qint64 modified = 0;
 	QVariantMap track;
 	QVariantMap metadata;
 	struct mpd_song* song = mpd_run_current_song(m_mpd_conn);
@@ -151,6 +345,7 @@ void MpdEventHandler::handlePlayerEvent(void)
 		QString genre(mpd_song_get_tag(song, MPD_TAG_GENRE, 0));
 		pos = mpd_song_get_pos(song);
 		uri = mpd_song_get_uri(song);
+		modified = mpd_song_get_last_modified(song);
 
 		if (title.isEmpty()) {
 			// If there's no tag, use the filename
@@ -213,126 +408,10 @@ void MpdEventHandler::handlePlayerEvent(void)
 	// For backend state tracking
 	emit playbackStateUpdate(pos, elapsed_ms, (state == MPD_STATE_PLAY));
 
-	if (uri.size()) {
-		// Send album art to UI as a separate update.
-		// This avoids things being out of sync than delaying while
-		// the art is is read.
-		// NOTE: Some form of caching might be desirable here.
-		QByteArray buffer;
-		QString mime_type;
-		if (getSongArt(uri, buffer, mime_type) && mime_type.size()) {
-			QString image_base64(buffer.toBase64());
-			QString mime_type_header("data:");
-			mime_type_header += mime_type;
-			mime_type_header += ";base64,";
-			image_base64.prepend(mime_type_header);
-
-			// Re-use metadata map...
-			track["image"] = image_base64;
-			metadata["track"] = track;
-
-			// ...but clear out the ephemeral metadata
-			metadata.remove("position");
-			metadata.remove("status");
-			metadata.remove("volume");
-
-			// Update UI
-			emit metadataUpdate(metadata);
-		}
-	}
-}
-
-bool MpdEventHandler::getSongArt(const QString &path, QByteArray &buffer, QString &type)
-{
-	bool rc = false;
-	unsigned pic_offset = 0;
-	unsigned pic_size = 0;
-
-	QByteArray path_ba = path.toLocal8Bit();
-	const char *path_cstr = path_ba.data();
-
-	bool first = true;
-	do {
-		QString pic_offset_str = QString::number(pic_offset);
-		QByteArray pic_offset_ba = pic_offset_str.toLocal8Bit();
-		const char *pic_offset_cstr = pic_offset_ba.data();
-
-		if (!mpd_send_command(m_mpd_conn, "readpicture", path_cstr, pic_offset_cstr, NULL)) {
-			if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS)
-				goto conn_error;
-		}
-		struct mpd_pair *pair = mpd_recv_pair_named(m_mpd_conn, "size");
-		if (!pair) {
-			if (first) {
-				// No art, exit
-				break;
-			}
-
-			if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS)
-				goto conn_error;
-		}
-		pic_size = QString(pair->value).toInt();
-		mpd_return_pair(m_mpd_conn, pair);
-
-		pair = mpd_recv_pair_named(m_mpd_conn, "type");
-		if (!pair) {
-			// check for error
-		}
-		QString mime_type(pair->value);
-		mpd_return_pair(m_mpd_conn, pair);
-		if (first) {
-			if (mime_type.size()) {
-				type = mime_type;
-			} else {
-				break;
-			}
-			first = false;
-		}
-
-		pair = mpd_recv_pair_named(m_mpd_conn, "binary");
-		if (!pair) {
-			if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS)
-				goto conn_error;
-		}
-
-		unsigned chunk_size = QString(pair->value).toInt();
-		mpd_return_pair(m_mpd_conn, pair);
-
-		if (!chunk_size)
-			break;
-
-		char *buf = new (std::nothrow) char[chunk_size];
-		if (!buf)
-			goto conn_error;
-
-		if (!mpd_recv_binary(m_mpd_conn, buf, chunk_size)) {
-			if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS) {
-				delete[] buf;
-				goto conn_error;
-			}
-		}
-
-		if (!mpd_response_finish(m_mpd_conn)) {
-			if (mpd_connection_get_error(m_mpd_conn) != MPD_ERROR_SUCCESS) {
-				delete[] buf;
-				goto conn_error;
-			}
-		}
-
-		buffer.append(buf, chunk_size);
-		delete[] buf;
-
-		pic_offset += chunk_size;
-
-	} while (pic_offset < pic_size);
-
-conn_error:
-	if (pic_offset == pic_size) {
-		rc = true;
-	} else {
-		// Don't pass garbage to caller
-		buffer.clear();
-	}
-
-	return rc;
+	// Album art is sent to the UI as a separate update by the fetcher
+	// thread, so reading it never holds up further events.
+	if (uri.size())
+		m_art_fetcher->request(track, modified);
+	else
+		m_art_fetcher->cancel();
 }
@@ -19,11 +19,17 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QVector>
+#include <QThread>
 #include <mpd/client.h>
+#include "AlbumArtFetcher.h"
 
 // Use a 60s timeout on our MPD connection
 #define MPD_CONNECTION_TIMEOUT	60000
 
+// Metadata for songs added to the queue is read this many at a time
+#define MPD_QUEUE_FETCH_BATCH	500
+
 class MpdEventHandler : public QObject
 {
 	Q_OBJECT
@@ -45,9 +51,19 @@ private:
 	void handleQueueEvent(void);
 	void handlePlayerEvent(void);
 
-	bool getSongArt(const QString &path, QByteArray &buffer, QString &type);
+	bool loadQueue(void);
+	bool updateQueue(void);
+	void queueError(void);
 
 	struct mpd_connection *m_mpd_conn;
+
+	// Queue version and song ids as last sent to the UI
+	bool m_queue_valid = false;
+	unsigned m_queue_version = 0;
+	QVector<unsigned> m_queue_ids;
+
+	AlbumArtFetcher *m_art_fetcher;
+	QThread m_art_thread;
 };
 
 #endif // MPD_EVENT_HANDLER_H
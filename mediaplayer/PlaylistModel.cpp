@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QSet>
+#include "PlaylistModel.h"
+
+PlaylistModel::PlaylistModel(QObject *parent) :
+	QAbstractListModel(parent)
+{
+}
+
+int PlaylistModel::rowCount(const QModelIndex &parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return m_tracks.count();
+}
+
+QVariant PlaylistModel::data(const QModelIndex &index, int role) const
+{
+	if (index.row() < 0 || index.row() >= m_tracks.count())
+		return QVariant();
+
+	const Track &track = m_tracks[index.row()];
+	switch (role) {
+	case DurationRole:
+		return track.duration;
+	case PathRole:
+		return track.path;
+	case TitleRole:
+		return track.title;
+	case AlbumRole:
+		return track.album;
+	case ArtistRole:
+		return track.artist;
+	case GenreRole:
+		return track.genre;
+	}
+
+	return QVariant();
+}
+
+void PlaylistModel::reset(const QVariantList &tracks)
+{
+	beginResetModel();
+	m_tracks.clear();
+	m_tracks.reserve(tracks.count());
+	for (const QVariant &item : tracks)
+		m_tracks.append(parseTrack(item.toMap()));
+	endResetModel();
+}
+
+void PlaylistModel::update(int length,
+			   const QVariantList &positions,
+			   const QVariantList &ids,
+			   const QVariantList &tracks)
+{
+	// Work out the song at each position after the update
+	int old_count = m_tracks.count();
+	QVector<unsigned> new_ids(length);
+	QVector<bool> filled(length, false);
+	for (int i = 0; i < qMin(length, old_count); i++) {
+		new_ids[i] = m_tracks[i].id;
+		filled[i] = true;
+	}
+	for (int i = 0; i < positions.count() && i < ids.count(); i++) {
+		int pos = positions[i].toInt();
+		if (pos < 0 || pos >= length)
+			continue;
+		new_ids[pos] = ids[i].toUInt();
+		filled[pos] = true;
+	}
+	if (filled.contains(false)) {
+		qWarning() << "PlaylistModel: incomplete queue update";
+		return;
+	}
+
+	QHash<unsigned, Track> changed;
+	for (const QVariant &item : tracks) {
+		Track track = parseTrack(item.toMap());
+		changed.insert(track.id, track);
+	}
+
+	// Leave the unchanged ends alone
+	int start = 0;
+	while (start < old_count && start < length && m_tracks[start].id == new_ids[start])
+		start++;
+	int old_end = old_count;
+	int new_end = length;
+	while (old_end > start && new_end > start && m_tracks[old_end - 1].id == new_ids[new_end - 1]) {
+		old_end--;
+		new_end--;
+	}
+
+	if ((old_end - start) + (new_end - start) > PLAYLIST_MAX_DIFF) {
+		resetTracks(new_ids, changed);
+		return;
+	}
+
+	// Remove the songs that are gone, in runs
+	QSet<unsigned> wanted;
+	for (int i = start; i < new_end; i++)
+		wanted.insert(new_ids[i]);
+	for (int row = old_end - 1; row >= start; row--) {
+		if (wanted.contains(m_tracks[row].id))
+			continue;
+		int last = row;
+		while (row > start && !wanted.contains(m_tracks[row - 1].id))
+			row--;
+		removeTracks(row, last);
+		old_end -= last - row + 1;
+	}
+
+	QSet<unsigned> present;
+	for (int row = start; row < old_end; row++)
+		present.insert(m_tracks[row].id);
+
+	// Then move or insert songs into place front to back
+	for (int i = start; i < new_end; i++) {
+		unsigned id = new_ids[i];
+		if (i < old_end && m_tracks[i].id == id)
+			continue;
+
+		if (present.contains(id)) {
+			int from = i + 1;
+			while (from < old_end && m_tracks[from].id != id)
+				from++;
+			if (from == old_end)
+				continue;
+			beginMoveRows(QModelIndex(), from, from, QModelIndex(), i);
+			m_tracks.move(from, i);
+			endMoveRows();
+			continue;
+		}
+
+		int last = i;
+		while (last + 1 < new_end && !present.contains(new_ids[last + 1]))
+			last++;
+		beginInsertRows(QModelIndex(), i, last);
+		for (int j = i; j <= last; j++) {
+			Track track = changed.value(new_ids[j]);
+			track.id = new_ids[j];
+			m_tracks.insert(j, track);
+			changed.remove(track.id);
+		}
+		endInsertRows();
+		old_end += last - i + 1;
+		i = last;
+	}
+
+	// Whatever is left is metadata for songs already in the queue
+	for (const QVariant &item : tracks) {
+		int row = item.toMap().value("index").toInt();
+		if (row < 0 || row >= m_tracks.count() || !changed.contains(m_tracks[row].id))
+			continue;
+		m_tracks[row] = changed.take(m_tracks[row].id);
+		emit dataChanged(index(row), index(row));
+	}
+}
+
+QHash<int, QByteArray> PlaylistModel::roleNames() const
+{
+	QHash<int, QByteArray> roles;
+	roles[DurationRole] = "duration";
+	roles[PathRole] = "path";
+	roles[TitleRole] = "title";
+	roles[AlbumRole] = "album";
+	roles[ArtistRole] = "artist";
+	roles[GenreRole] = "genre";
+
+	return roles;
+}
+
+PlaylistModel::Track PlaylistModel::parseTrack(const QVariantMap &item)
+{
+	Track track;
+	track.id = item["id"].toUInt();
+	track.duration = item["duration"].toInt();
+	track.path = item["path"].toString();
+	track.title = item["title"].toString();
+	track.album = item["album"].toString();
+	track.artist = item["artist"].toString();
+	track.genre = item["genre"].toString();
+	return track;
+}
+
+void PlaylistModel::removeTracks(int first, int last)
+{
+	beginRemoveRows(QModelIndex(), first, last);
+	m_tracks.remove(first, last - first + 1);
+	endRemoveRows();
+}
+
+void PlaylistModel::resetTracks(const QVector<unsigned> &ids, const QHash<unsigned, Track> &tracks)
+{
+	QHash<unsigned, int> rows;
+	for (int row = 0; row < m_tracks.count(); row++)
+		rows.insert(m_tracks[row].id, row);
+
+	QVector<Track> updated;
+	updated.reserve(ids.count());
+	for (unsigned id : ids) {
+		if (tracks.contains(id)) {
+			updated.append(tracks.value(id));
+		} else if (rows.contains(id)) {
+			updated.append(m_tracks[rows.value(id)]);
+		} else {
+			Track track;
+			track.id = id;
+			updated.append(track);
+		}
+	}
+
+	beginResetModel();
+	m_tracks = updated;
+	endResetModel();
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PLAYLIST_MODEL_H
+#define PLAYLIST_MODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QVariant>
+
+// Above this many rows changed in one update, a reset is cheaper for
+// the views than a stream of row moves.
+#define PLAYLIST_MAX_DIFF	2000
+
+// The play queue for QML, one row per song with the same role names
+// as the properties of the Playlist objects it replaces.  Updates are
+// applied as row inserts, removes and moves so that views keep their
+// state.  The queue position is the row, i.e. the delegate's index.
+
+class PlaylistModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+public:
+	enum PlaylistRoles {
+		DurationRole = Qt::UserRole + 1,
+		PathRole,
+		TitleRole,
+		AlbumRole,
+		ArtistRole,
+		GenreRole
+	};
+
+	explicit PlaylistModel(QObject *parent = Q_NULLPTR);
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+	// Replaces the whole queue, tracks are the maps sent by the MPD
+	// event handler.
+	void reset(const QVariantList &tracks);
+
+	// Applies a queue delta: the queue is now length songs long, with
+	// song ids[i] at positions[i] and everything else where it was.
+	// tracks has the metadata of new or changed songs.
+	void update(int length,
+		    const QVariantList &positions,
+		    const QVariantList &ids,
+		    const QVariantList &tracks);
+
+protected:
+	QHash<int, QByteArray> roleNames() const override;
+
+private:
+	struct Track {
+		unsigned id = 0;
+		int duration = 0;
+		QString path;
+		QString title;
+		QString album;
+		QString artist;
+		QString genre;
+	};
+
+	static Track parseTrack(const QVariantMap &item);
+
+	void removeTracks(int first, int last);
+	void resetTracks(const QVector<unsigned> &ids, const QHash<unsigned, Track> &tracks);
+
+	QVector<Track> m_tracks;
+};
+
+#endif // PLAYLIST_MODEL_H
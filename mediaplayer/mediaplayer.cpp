@@ -16,30 +16,27 @@
 
 #include <QDebug>
 #include <QMutexLocker>
+#include <QQmlEngine>
 
 #include "mediaplayer.h"
+#include "AlbumArtProvider.h"
+#include "PlaylistModel.h"
 #include "MediaplayerMpdBackend.h"
 #include "MediaplayerBluezBackend.h"
 
 
-Playlist::Playlist(QVariantMap &item)
-{
-	m_index = item["index"].toInt();
-	m_duration = item["duration"].toInt();
-	m_genre = item["genre"].toString();
-	m_path = item["path"].toString();
-	m_title = item["title"].toString();
-	m_album = item["album"].toString();
-	m_artist = item["artist"].toString();
-}
-
-Playlist::~Playlist() {}
-
 Mediaplayer::Mediaplayer(QQmlContext *context, QObject * parent) :
 	QObject(parent)
 {
 	m_context = context;
-	m_context->setContextProperty("MediaplayerModel", QVariant::fromValue(m_playlist));
+	m_playlist = new PlaylistModel(this);
+	m_context->setContextProperty("MediaplayerModel", m_playlist);
+
+	// AlbumArt is set to image://albumart/<id> URLs, the engine takes
+	// ownership of the provider.
+	QQmlEngine *engine = m_context->engine();
+	if (engine && !engine->imageProvider(ALBUM_ART_PROVIDER_ID))
+		engine->addImageProvider(ALBUM_ART_PROVIDER_ID, new AlbumArtProvider);
 
 	m_mpd_backend = new MediaplayerMpdBackend(this, context);
 	if (!m_mpd_backend)
@@ -67,16 +64,17 @@ void Mediaplayer::start()
 
 void Mediaplayer::updateLocalPlaylist(QVariantMap playlist)
 {
-	QVariantList list = playlist["list"].toList();
-
-	m_playlist.clear();
-
-	for (auto i : list) {
-		QVariantMap item = qvariant_cast<QVariantMap>(i);
-		m_playlist.append(new Playlist(item));
+	// Either the whole queue or what changed since the last update
+	if (playlist.contains("list")) {
+		m_playlist->reset(playlist["list"].toList());
+	} else {
+		m_playlist->update(playlist["length"].toInt(),
+				   playlist["positions"].toList(),
+				   playlist["ids"].toList(),
+				   playlist["tracks"].toList());
 	}
 
-	if (m_playlist.count() == 0) {
+	if (m_playlist->rowCount() == 0) {
 		QVariantMap tmp, track;
 
 		track.insert("title", "");
@@ -91,9 +89,6 @@ void Mediaplayer::updateLocalPlaylist(QVariantMap playlist)
 		m_context->setContextProperty("AlbumArt", "");
 		emit metadataChanged(tmp);
 	}
-
-	// Refresh model
-	m_context->setContextProperty("MediaplayerModel", QVariant::fromValue(m_playlist));
 }
 
 void Mediaplayer::updateLocalMetadata(QVariantMap metadata)
@@ -20,51 +20,8 @@
 #include <QObject>
 #include <QMutex>
 #include <QtQml/QQmlContext>
-#include <QtQml/QQmlListProperty>
-
-class Playlist : public QObject
-{
-	Q_OBJECT
-
-	Q_PROPERTY(int index READ index NOTIFY indexChanged)
-	Q_PROPERTY(int duration READ duration NOTIFY durationChanged)
-	Q_PROPERTY(QString path READ path NOTIFY pathChanged)
-
-	// METADATA FIELDS
-	Q_PROPERTY(QString title READ title NOTIFY titleChanged)
-	Q_PROPERTY(QString album READ album NOTIFY albumChanged)
-	Q_PROPERTY(QString artist READ artist NOTIFY artistChanged)
-	Q_PROPERTY(QString genre READ genre NOTIFY genreChanged)
-
-public:
-	explicit Playlist(QVariantMap& item);
-	virtual ~Playlist();
-
-	bool operator<(Playlist& c) { return ((this->m_index < c.m_index)); };
-	int index() { return m_index; };
-	int duration() { return m_duration; };
-	QString path() { return m_path; };
-
-	// METADATA FIELDS
-	QString title() { return m_title; };
-	QString album() { return m_album; };
-	QString artist() { return m_artist; };
-	QString genre() { return m_genre; };
-
-signals:
-	void indexChanged();
-	void durationChanged();
-	void pathChanged();
-	void titleChanged();
-	void albumChanged();
-	void artistChanged();
-	void genreChanged();
-
-private:
-	int m_index, m_duration;
-	QString m_path, m_title, m_album, m_artist, m_genre;
-};
 
+class PlaylistModel;
 class MediaplayerBackend;
 class MediaplayerMpdBackend;
 class MediaplayerBluezBackend;
@@ -109,7 +66,7 @@ private:
 	void updateMetadata(QVariantMap &metadata);
 
 	QQmlContext *m_context;
-	QList<QObject *> m_playlist;
+	PlaylistModel *m_playlist;
 
 	MediaplayerBackend *m_backend;
 	MediaplayerMpdBackend *m_mpd_backend;
@@ -15,27 +15,94 @@
  */
 
 #include <QDebug>
+#include <QDateTime>
+#include <QMetaMethod>
 
 #include "navigation.h"
+#include "navigationroute.h"
+#include "positioninterpolator.h"
 #include "vehiclesignals.h"
 
+// Default interpolated position update interval, i.e. ~60 Hz
+#define DEFAULT_INTERPOLATION_INTERVAL	16
+
+// Maximum difference between the timestamps of signals set together
+#define SNAPSHOT_WINDOW	100
+
 Navigation::Navigation(VehicleSignals *vs, QObject * parent) :
 	QObject(parent),
 	m_vs(vs),
-	m_connected(false)
-
+	m_connected(false),
+	m_latitude(0.0),
+	m_longitude(0.0),
+	m_position{ 1u << Latitude | 1u << Longitude | 1u << Heading | 1u << Distance, 0, 0, {} },
+	m_destination{ 1u << DestinationLatitude | 1u << DestinationLongitude, 0, 0, {} },
+	m_interpolate(false),
+	m_interpolator(new PositionInterpolator),
+	m_route(new NavigationRoute)
 {
+	m_clock.start();
+	m_interpolation_timer.setTimerType(Qt::PreciseTimer);
+	m_interpolation_timer.setInterval(DEFAULT_INTERPOLATION_INTERVAL);
+	QObject::connect(&m_interpolation_timer, &QTimer::timeout, this, &Navigation::onInterpolationTimeout);
+
 	QObject::connect(m_vs, &VehicleSignals::connected, this, &Navigation::onConnected);
 	QObject::connect(m_vs, &VehicleSignals::authorized, this, &Navigation::onAuthorized);
 	QObject::connect(m_vs, &VehicleSignals::disconnected, this, &Navigation::onDisconnected);
 
-	if (m_vs)
-		m_vs->connect();
+	if (!m_vs)
+		return;
+
+	// Notifications are routed straight to the handler for their path
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.State", this,
+			       [this](const QVariant &value, const QString &) { updateState(value); });
+	m_vs->addSignalHandler("Vehicle.CurrentLocation.Latitude", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(Latitude, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.CurrentLocation.Longitude", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(Longitude, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.CurrentLocation.Heading", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(Heading, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(Distance, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(DestinationLatitude, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude", this,
+			       [this](const QVariant &value, const QString &timestamp) { updateField(DestinationLongitude, value, timestamp); });
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.Route", this,
+			       [this](const QVariant &value, const QString &) { m_route->setRoute(value.toString()); });
+	m_vs->addSignalHandler("Vehicle.Cabin.Infotainment.Navigation.RouteChange", this,
+			       [this](const QVariant &value, const QString &) { updateRouteChange(value); });
+
+	m_vs->connect();
 }
 
 Navigation::~Navigation()
 {
 	delete m_vs;
+	delete m_interpolator;
+	delete m_route;
+}
+
+void Navigation::setInterpolate(bool interpolate)
+{
+	if (interpolate == m_interpolate)
+		return;
+
+	m_interpolate = interpolate;
+	if (!interpolate) {
+		m_interpolation_timer.stop();
+		m_interpolator->reset();
+	}
+	emit interpolateChanged(interpolate);
+}
+
+void Navigation::setInterpolationInterval(int interval)
+{
+	if (interval <= 0 || interval == m_interpolation_timer.interval())
+		return;
+
+	m_interpolation_timer.setInterval(interval);
+	emit interpolationIntervalChanged(interval);
 }
 
 void Navigation::sendWaypoint(double lat, double lon)
@@ -43,13 +110,44 @@ void Navigation::sendWaypoint(double lat, double lon)
 	if (!(m_vs && m_connected))
 		return;
 
-	// The original implementation resulted in at least 9 decimal places
-	// making it through to the clients, so explicitly format for 9.  In
-	// practice going from the QString default 6 to 9 does make a difference
-	// with respect to smoothness in the position-based map rotations done
-	// in tbtnavi.
-	m_vs->set("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude", QString::number(lat, 'f', 9));
-	m_vs->set("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude", QString::number(lon, 'f', 9));
+	// Coordinates are sent as doubles to keep full precision, at least
+	// 9 decimal places make a noticeable difference with respect to
+	// smoothness in the position-based map rotations done in tbtnavi.
+	QVariantMap values;
+	values["Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude"] = lat;
+	values["Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude"] = lon;
+	m_vs->setMany(values);
+}
+
+void Navigation::sendRoute(const QVariantList &waypoints)
+{
+	updateRoute(0, -1, waypoints);
+}
+
+void Navigation::updateRoute(int start, int removed, const QVariantList &waypoints)
+{
+	if (!(m_vs && m_connected))
+		return;
+
+	// NOTE: These signals are AGL additions as well.  The route is
+	//       sent as an encoded polyline in a single string value
+	//       instead of a signal per point, see NavigationRoute for
+	//       the format.
+	QString route, change;
+	m_route->splice(start, removed, NavigationRoute::fromVariantList(waypoints), route, change);
+
+	QVariantMap values;
+	values["Vehicle.Cabin.Infotainment.Navigation.Route"] = route;
+	values["Vehicle.Cabin.Infotainment.Navigation.RouteChange"] = change;
+	m_vs->setMany(values);
+
+	// Our own change is ignored when it comes back
+	notifyRouteChanged(start, removed, waypoints);
+}
+
+QVariantList Navigation::route() const
+{
+	return NavigationRoute::toVariantList(m_route->points());
 }
 
 void Navigation::broadcastPosition(double lat, double lon, double drc, double dst)
@@ -57,9 +155,10 @@ void Navigation::broadcastPosition(double lat, double lon, double drc, double ds
 	if (!(m_vs && m_connected))
 		return;
 
-	m_vs->set("Vehicle.CurrentLocation.Latitude", QString::number(lat, 'f', 9));
-	m_vs->set("Vehicle.CurrentLocation.Longitude", QString::number(lon, 'f', 9));
-	m_vs->set("Vehicle.CurrentLocation.Heading", QString::number(drc, 'f', 9));
+	QVariantMap values;
+	values["Vehicle.CurrentLocation.Latitude"] = lat;
+	values["Vehicle.CurrentLocation.Longitude"] = lon;
+	values["Vehicle.CurrentLocation.Heading"] = drc;
 
 	// NOTES:
 	// - This signal is an AGL addition, it may make sense to engage with the
@@ -67,7 +166,10 @@ void Navigation::broadcastPosition(double lat, double lon, double drc, double ds
 	// - The signal makes more sense in kilometers wrt VSS expectations, so
 	//   conversion from meters happens here for now to avoid changing the
 	//   existing clients.  This may be worth revisiting down the road.
-	m_vs->set("Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance", QString::number(dst / 1000, 'f', 9));
+	// - Receivers assemble the position from all four signals by their
+	//   timestamps, so they are set together.
+	values["Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance"] = dst / 1000;
+	m_vs->setMany(values);
 }
 
 void Navigation::broadcastRouteInfo(double lat, double lon, double route_lat, double route_lon)
@@ -75,11 +177,16 @@ void Navigation::broadcastRouteInfo(double lat, double lon, double route_lat, do
 	if (!(m_vs && m_connected))
 		return;
 
-	m_vs->set("Vehicle.CurrentLocation.Latitude", QString::number(lat, 'f', 9));
-	m_vs->set("Vehicle.CurrentLocation.Longitude", QString::number(lon, 'f', 9));
+	// NOTE: The car position is not sent along, receivers only take
+	//       complete positions from broadcastPosition and would drop
+	//       it.  The route event carries the latest of those instead.
+	Q_UNUSED(lat);
+	Q_UNUSED(lon);
 
-	m_vs->set("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude", QString::number(route_lat, 'f', 9));
-	m_vs->set("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude", QString::number(route_lon, 'f', 9));
+	QVariantMap values;
+	values["Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude"] = route_lat;
+	values["Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude"] = route_lon;
+	m_vs->setMany(values);
 }
 
 void Navigation::broadcastStatus(QString state)
@@ -107,71 +214,183 @@ void Navigation::onAuthorized()
 
 	m_connected = true;
 
-	QObject::connect(m_vs, &VehicleSignals::signalNotification, this, &Navigation::onSignalNotification);
-
 	// NOTE: This signal is another AGL addition where it is possible
 	//       upstream may be open to adding it to VSS.
-	m_vs->subscribe("Vehicle.Cabin.Infotainment.Navigation.State");
-	m_vs->subscribe("Vehicle.CurrentLocation.Latitude");
-	m_vs->subscribe("Vehicle.CurrentLocation.Longitude");
-	m_vs->subscribe("Vehicle.CurrentLocation.Heading");
-	m_vs->subscribe("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude");
-	m_vs->subscribe("Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude");
-	m_vs->subscribe("Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance");
+	QStringList paths;
+	paths << "Vehicle.Cabin.Infotainment.Navigation.State"
+	      << "Vehicle.CurrentLocation.Latitude"
+	      << "Vehicle.CurrentLocation.Longitude"
+	      << "Vehicle.CurrentLocation.Heading"
+	      << "Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude"
+	      << "Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude"
+	      << "Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance"
+	      << "Vehicle.Cabin.Infotainment.Navigation.Route"
+	      << "Vehicle.Cabin.Infotainment.Navigation.RouteChange";
+	m_vs->subscribeMany(paths);
+
+	// Pick up the route if one was set before we connected
+	m_vs->get("Vehicle.Cabin.Infotainment.Navigation.Route", [this](const VehicleSignalsResponse &response) {
+		int removed = 0;
+		if (response.success && m_route->applyRoute(response.value.toString(), removed))
+			notifyRouteChanged(0, removed, route());
+	});
 }
 
 void Navigation::onDisconnected()
 {
-	QObject::disconnect(m_vs, &VehicleSignals::signalNotification, this, &Navigation::onSignalNotification);
-
 	m_connected = false;
+
+	m_interpolation_timer.stop();
+	m_interpolator->reset();
+
+	// Do not mix samples from before and after reconnecting
+	m_position.received = 0;
+	m_destination.received = 0;
 }
 
-void Navigation::onSignalNotification(QString path, QString value, QString timestamp)
-{
-	// NOTE: Since all the known AGL users of the VSS signals are users of
-	//       this API, we know that updates occur in certain sequences and
-	//       can leverage this to roll up for emitting the existing events.
-	//       This is the path of least effort with respect to changing
-	//       the existing clients, but it may make sense down the road to
-	//       either switch them to using VehicleSignals directly or having
-	//       a more granular signal scheme that maps more directly onto
-	//       VSS.
-	if (path == "Vehicle.Cabin.Infotainment.Navigation.State") {
-		QVariantMap event;
-		event["state"] = value;
-		emit statusEvent(event);
-	} else if (path == "Vehicle.CurrentLocation.Latitude") {
-		m_latitude = value.toDouble();
-	} else if (path == "Vehicle.CurrentLocation.Longitude") {
-		m_longitude = value.toDouble();
-	} else if (path == "Vehicle.CurrentLocation.Heading") {
-		m_heading = value.toDouble();
-	} else if (path == "Vehicle.Cabin.Infotainment.Navigation.ElapsedDistance") {
-		m_distance = value.toDouble();
-		QVariantMap event;
-		event["position"] = "car";
-		event["latitude"] = m_latitude;
-		event["longitude"] = m_longitude;
-		event["direction"] = m_heading;
-		event["distance"] = m_distance * 1000;
-		emit positionEvent(event);
-	} else if (path == "Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Latitude") {
-		m_dest_latitude = value.toDouble();
-	} else if (path == "Vehicle.Cabin.Infotainment.Navigation.DestinationSet.Longitude") {
-		m_dest_longitude = value.toDouble();
-		QVariantMap event;
-		event["position"] = "route";
-		event["latitude"] = m_latitude;
-		event["longitude"] = m_longitude;
-		event["route_latitude"] = m_dest_latitude;
-		event["route_longitude"] = m_dest_longitude;
-		emit positionEvent(event);
-
-		// NOTE: Potentially could emit a waypointsEvent here, but
-		//       nothing in the demo currently requires it, so do
-		//       not bother for now.  If something like Alexa is
-		//       added it or some other replacement / rework will
-		//       be required.
+void Navigation::onInterpolationTimeout()
+{
+	qint64 now = m_clock.elapsed();
+	NavigationPosition position;
+	if (!m_interpolator->position(now, position)) {
+		m_interpolation_timer.stop();
+		return;
 	}
+
+	QVariantMap event;
+	event["position"] = "car";
+	event["latitude"] = position.latitude;
+	event["longitude"] = position.longitude;
+	event["direction"] = position.heading;
+	event["distance"] = position.distance;
+	event["interpolated"] = true;
+	emit positionEvent(event);
+
+	// Idle until the next sample once the position has settled
+	if (!m_interpolator->active(now))
+		m_interpolation_timer.stop();
+}
+
+void Navigation::updateState(const QVariant &value)
+{
+	QVariantMap event;
+	event["state"] = value.toString();
+	emit statusEvent(event);
+}
+
+void Navigation::updateField(Field field, const QVariant &value, const QString &timestamp)
+{
+	double v = value.toDouble();
+
+	// The timestamp is when the signal was set, fall back to when it
+	// arrived if the server does not provide one.
+	QDateTime time = QDateTime::fromString(timestamp, Qt::ISODateWithMs);
+	qint64 t = time.isValid() ? time.toMSecsSinceEpoch() : QDateTime::currentMSecsSinceEpoch();
+
+	switch (field) {
+	case Latitude:
+		m_latitude = v;
+		break;
+	case Longitude:
+		m_longitude = v;
+		break;
+	case Distance:
+		// NOTE: The signal is in kilometers, see broadcastPosition
+		v *= 1000;
+		break;
+	default:
+		break;
+	}
+
+	if (field == DestinationLatitude || field == DestinationLongitude) {
+		if (addField(m_destination, field, v, t))
+			updateDestination(m_destination);
+	} else {
+		if (addField(m_position, field, v, t))
+			updatePosition(m_position);
+	}
+}
+
+bool Navigation::addField(Snapshot &snapshot, Field field, double value, qint64 time)
+{
+	// A field seen again, or one set too long after the others,
+	// starts a new sample.  Anything partial from before is dropped
+	// rather than mixed in.
+	unsigned int bit = 1u << field;
+	if (snapshot.received &&
+	    ((snapshot.received & bit) || qAbs(time - snapshot.time) > SNAPSHOT_WINDOW))
+		snapshot.received = 0;
+
+	if (!snapshot.received)
+		snapshot.time = time;
+	snapshot.values[field] = value;
+	snapshot.received |= bit;
+
+	if ((snapshot.received & snapshot.required) != snapshot.required)
+		return false;
+
+	snapshot.received = 0;
+	return true;
+}
+
+void Navigation::updatePosition(const Snapshot &snapshot)
+{
+	if (m_interpolate) {
+		NavigationPosition position;
+		position.latitude = snapshot.values[Latitude];
+		position.longitude = snapshot.values[Longitude];
+		position.heading = snapshot.values[Heading];
+		position.distance = snapshot.values[Distance];
+		m_interpolator->addSample(position, snapshot.time, m_clock.elapsed());
+
+		if (!m_interpolation_timer.isActive()) {
+			m_interpolation_timer.start();
+			onInterpolationTimeout();
+		}
+		return;
+	}
+
+	QVariantMap event;
+	event["position"] = "car";
+	event["latitude"] = snapshot.values[Latitude];
+	event["longitude"] = snapshot.values[Longitude];
+	event["direction"] = snapshot.values[Heading];
+	event["distance"] = snapshot.values[Distance];
+	emit positionEvent(event);
+}
+
+void Navigation::updateDestination(const Snapshot &snapshot)
+{
+	QVariantMap event;
+	event["position"] = "route";
+	event["latitude"] = m_latitude;
+	event["longitude"] = m_longitude;
+	event["route_latitude"] = snapshot.values[DestinationLatitude];
+	event["route_longitude"] = snapshot.values[DestinationLongitude];
+	emit positionEvent(event);
+
+	// NOTE: Multiple waypoints are handled by the route signals,
+	//       see updateRoute, which emit waypointsEvent.
+}
+
+void Navigation::updateRouteChange(const QVariant &value)
+{
+	int start, removed;
+	QVector<RoutePoint> inserted;
+	if (m_route->applyChange(value.toString(), start, removed, inserted))
+		notifyRouteChanged(start, removed, NavigationRoute::toVariantList(inserted));
+}
+
+void Navigation::notifyRouteChanged(int start, int removed, const QVariantList &waypoints)
+{
+	emit routeChanged(start, removed, waypoints);
+
+	// Only build the whole list if someone is listening for it
+	if (!isSignalConnected(QMetaMethod::fromSignal(&Navigation::waypointsEvent)))
+		return;
+
+	QVariantMap event;
+	event["version"] = m_route->version();
+	event["waypoints"] = route();
+	emit waypointsEvent(event);
 }
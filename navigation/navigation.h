@@ -19,13 +19,23 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QTimer>
+#include <QElapsedTimer>
 
 class VehicleSignals;
+class PositionInterpolator;
+class NavigationRoute;
 
 class Navigation : public QObject
 {
 	Q_OBJECT
 
+	// When enabled, "car" positionEvents are emitted every
+	// interpolationInterval ms with the position extrapolated from the
+	// last samples, instead of once per received position.
+	Q_PROPERTY(bool interpolate READ interpolate WRITE setInterpolate NOTIFY interpolateChanged)
+	Q_PROPERTY(int interpolationInterval READ interpolationInterval WRITE setInterpolationInterval NOTIFY interpolationIntervalChanged)
+
 public:
 	explicit Navigation(VehicleSignals *vs, QObject *parent = Q_NULLPTR);
 	virtual ~Navigation();
@@ -37,26 +47,74 @@ public:
 	// only support one waypoint for now
 	Q_INVOKABLE void sendWaypoint(double lat, double lon);
 
+	// Route shared with other Navigation users, as a list of maps with
+	// latitude and longitude.  updateRoute replaces removed points
+	// starting at start (all of the rest if -1) with waypoints.
+	Q_INVOKABLE void sendRoute(const QVariantList &waypoints);
+	Q_INVOKABLE void updateRoute(int start, int removed, const QVariantList &waypoints);
+	Q_INVOKABLE QVariantList route() const;
+
+	bool interpolate() const { return m_interpolate; };
+	void setInterpolate(bool interpolate);
+	int interpolationInterval() const { return m_interpolation_timer.interval(); };
+	void setInterpolationInterval(int interval);
+
 signals:
 	void statusEvent(QVariantMap data);
 	void positionEvent(QVariantMap data);
 	void waypointsEvent(QVariantMap data);
+	void routeChanged(int start, int removed, QVariantList waypoints);
+	void interpolateChanged(bool interpolate);
+	void interpolationIntervalChanged(int interval);
 
 private slots:
 	void onConnected();
 	void onAuthorized();
 	void onDisconnected();
-	void onSignalNotification(QString path, QString value, QString timestamp);
+	void onInterpolationTimeout();
 
 private:
+	enum Field {
+		Latitude,
+		Longitude,
+		Heading,
+		Distance,		// meters
+		DestinationLatitude,
+		DestinationLongitude,
+		NumFields
+	};
+
+	// Signals that are set together (e.g. by broadcastPosition) are
+	// assembled into a snapshot using their VIS timestamps, and only
+	// used once all of them have arrived from the same update.
+	struct Snapshot {
+		unsigned int required;	// mask of the fields making it up
+		unsigned int received;
+		qint64 time;		// ms since the epoch
+		double values[NumFields];
+	};
+
+	void updateState(const QVariant &value);
+	void updateField(Field field, const QVariant &value, const QString &timestamp);
+	bool addField(Snapshot &snapshot, Field field, double value, qint64 time);
+	void updatePosition(const Snapshot &snapshot);
+	void updateDestination(const Snapshot &snapshot);
+	void updateRouteChange(const QVariant &value);
+	void notifyRouteChanged(int start, int removed, const QVariantList &waypoints);
+
 	VehicleSignals *m_vs;
 	bool m_connected;
+	// Latest car position, for route updates
 	double m_latitude;
 	double m_longitude;
-	double m_heading;
-	double m_distance;
-	double m_dest_latitude;
-	double m_dest_longitude;
+	Snapshot m_position;
+	Snapshot m_destination;
+
+	bool m_interpolate;
+	PositionInterpolator *m_interpolator;
+	NavigationRoute *m_route;
+	QTimer m_interpolation_timer;
+	QElapsedTimer m_clock;
 };
 
 #endif // NAVIGATION_H
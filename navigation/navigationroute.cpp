@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QVariantMap>
+#include <QStringList>
+
+#include "navigationroute.h"
+
+static void replacePoints(QVector<RoutePoint> &points, int start, int removed,
+			  const QVector<RoutePoint> &inserted)
+{
+	QVector<RoutePoint> result;
+	result.reserve(points.size() - removed + inserted.size());
+	result.append(points.mid(0, start));
+	result.append(inserted);
+	result.append(points.mid(start + removed));
+	points.swap(result);
+}
+
+void NavigationRoute::splice(int &start, int &removed, const QVector<RoutePoint> &points,
+			     QString &route, QString &change)
+{
+	start = qBound(0, start, m_points.size());
+	if (removed < 0 || removed > m_points.size() - start)
+		removed = m_points.size() - start;
+
+	replacePoints(m_points, start, removed, points);
+	m_version++;
+	m_route.clear();
+
+	route = QString("%1;%2").arg(m_version).arg(encodePolyline(m_points));
+	change = QString("%1;%2;%3;%4").arg(m_version).arg(start).arg(removed).arg(encodePolyline(points));
+}
+
+void NavigationRoute::setRoute(const QString &value)
+{
+	m_route = value;
+}
+
+bool NavigationRoute::applyRoute(const QString &value, int &removed)
+{
+	unsigned int version;
+	QVector<RoutePoint> points;
+	if (!parseRoute(value, version, points) || version <= m_version)
+		return false;
+
+	removed = m_points.size();
+	m_points = points;
+	m_version = version;
+	m_route.clear();
+	return true;
+}
+
+bool NavigationRoute::applyChange(const QString &value, int &start, int &removed,
+				  QVector<RoutePoint> &inserted)
+{
+	QStringList fields = value.split(';');
+	if (fields.size() != 4)
+		return false;
+
+	bool ok = false;
+	unsigned int version = fields[0].toUInt(&ok);
+	// Our own change coming back, or an old one
+	if (!ok || version <= m_version)
+		return false;
+
+	bool startOk = false, removedOk = false;
+	start = fields[1].toInt(&startOk);
+	removed = fields[2].toInt(&removedOk);
+	if (version == m_version + 1 && startOk && removedOk &&
+	    start >= 0 && start <= m_points.size() &&
+	    removed >= 0 && removed <= m_points.size() - start &&
+	    decodePolyline(fields[3], inserted)) {
+		replacePoints(m_points, start, removed, inserted);
+		m_version = version;
+		m_route.clear();
+		return true;
+	}
+
+	// Missed a change, catch up with the whole route if it is the
+	// matching one.
+	unsigned int routeVersion;
+	QVector<RoutePoint> points;
+	if (m_route.isEmpty() || !parseRoute(m_route, routeVersion, points) || routeVersion != version)
+		return false;
+
+	start = 0;
+	removed = m_points.size();
+	inserted = points;
+	m_points = points;
+	m_version = version;
+	m_route.clear();
+	return true;
+}
+
+bool NavigationRoute::parseRoute(const QString &value, unsigned int &version, QVector<RoutePoint> &points)
+{
+	int separator = value.indexOf(';');
+	if (separator < 0)
+		return false;
+
+	bool ok = false;
+	version = value.leftRef(separator).toUInt(&ok);
+	return ok && decodePolyline(value.mid(separator + 1), points);
+}
+
+QVector<RoutePoint> NavigationRoute::fromVariantList(const QVariantList &list)
+{
+	QVector<RoutePoint> points;
+	points.reserve(list.size());
+	for (const QVariant &item : list) {
+		QVariantMap map = item.toMap();
+		points.append({ map["latitude"].toDouble(), map["longitude"].toDouble() });
+	}
+	return points;
+}
+
+QVariantList NavigationRoute::toVariantList(const QVector<RoutePoint> &points)
+{
+	QVariantList list;
+	list.reserve(points.size());
+	for (const RoutePoint &point : points) {
+		QVariantMap map;
+		map["latitude"] = point.latitude;
+		map["longitude"] = point.longitude;
+		list.append(map);
+	}
+	return list;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NAVIGATION_ROUTE_H
+#define NAVIGATION_ROUTE_H
+
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+#include "polyline.h"
+
+// Versioned copy of the shared route.  The route is carried by two
+// string signals, both set in one batch on every change:
+//
+// Route:        "<version>;<polyline>", the whole route
+// RouteChange:  "<version>;<start>;<removed>;<polyline>", the points
+//               replacing points start..start+removed-1 of the previous
+//               version
+//
+// Changes are applied as they come in, the whole route is only used
+// when joining late or after missing a change.
+
+class NavigationRoute
+{
+public:
+	unsigned int version() const { return m_version; };
+	const QVector<RoutePoint> &points() const { return m_points; };
+
+	// Local change, start and removed are clamped to the route.
+	// Returns the values to set the Route and RouteChange signals to.
+	void splice(int &start, int &removed, const QVector<RoutePoint> &points,
+		    QString &route, QString &change);
+
+	// Route signal value, kept until a matching change comes in
+	void setRoute(const QString &value);
+
+	// Whole route, e.g. from a get, applied if newer than what we have
+	bool applyRoute(const QString &value, int &removed);
+
+	// RouteChange signal value, on success start/removed/inserted
+	// describe the change applied.
+	bool applyChange(const QString &value, int &start, int &removed,
+			 QVector<RoutePoint> &inserted);
+
+	static QVector<RoutePoint> fromVariantList(const QVariantList &list);
+	static QVariantList toVariantList(const QVector<RoutePoint> &points);
+
+private:
+	static bool parseRoute(const QString &value, unsigned int &version, QVector<RoutePoint> &points);
+
+	unsigned int m_version = 0;
+	QVector<RoutePoint> m_points;
+
+	// Latest Route signal value not applied yet
+	QString m_route;
+};
+
+#endif // NAVIGATION_ROUTE_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QtMath>
+
+#include "polyline.h"
+
+#define PRECISION	1e6
+
+static void encodeValue(qint64 value, QByteArray &out)
+{
+	quint64 v = value < 0 ? ~(quint64(value) << 1) : quint64(value) << 1;
+	while (v >= 0x20) {
+		out.append(char((0x20 | (v & 0x1f)) + 63));
+		v >>= 5;
+	}
+	out.append(char(v + 63));
+}
+
+static bool decodeValue(const QByteArray &in, int &pos, qint64 &value)
+{
+	quint64 result = 0;
+	int shift = 0;
+	while (pos < in.size()) {
+		int c = in[pos++] - 63;
+		if (c < 0 || c > 0x3f || shift > 60)
+			return false;
+		result |= quint64(c & 0x1f) << shift;
+		shift += 5;
+		if (c < 0x20) {
+			value = (result & 1) ? ~qint64(result >> 1) : qint64(result >> 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+QString encodePolyline(const QVector<RoutePoint> &points)
+{
+	QByteArray out;
+	// Typically 6-10 characters per point
+	out.reserve(points.size() * 10);
+
+	qint64 lastLat = 0;
+	qint64 lastLon = 0;
+	for (const RoutePoint &point : points) {
+		qint64 lat = qRound64(point.latitude * PRECISION);
+		qint64 lon = qRound64(point.longitude * PRECISION);
+		encodeValue(lat - lastLat, out);
+		encodeValue(lon - lastLon, out);
+		lastLat = lat;
+		lastLon = lon;
+	}
+	return QString::fromLatin1(out);
+}
+
+bool decodePolyline(const QString &encoded, QVector<RoutePoint> &points)
+{
+	QByteArray in = encoded.toLatin1();
+	points.clear();
+	points.reserve(in.size() / 6);
+
+	qint64 lat = 0;
+	qint64 lon = 0;
+	int pos = 0;
+	while (pos < in.size()) {
+		qint64 dlat, dlon;
+		if (!decodeValue(in, pos, dlat) || !decodeValue(in, pos, dlon))
+			return false;
+		lat += dlat;
+		lon += dlon;
+		points.append({ lat / PRECISION, lon / PRECISION });
+	}
+	return true;
+}
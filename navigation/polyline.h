@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POLYLINE_H
+#define POLYLINE_H
+
+#include <QString>
+#include <QVector>
+
+struct RoutePoint
+{
+	double latitude;
+	double longitude;
+};
+
+// Encoded polyline format as used by e.g. Google Maps and OSRM, with
+// 6 decimal places (~0.1 m) of precision.  Each coordinate is stored as
+// a delta from the previous point, so a route of a few hundred points
+// takes a few kilobytes as a single printable ASCII string.
+
+QString encodePolyline(const QVector<RoutePoint> &points);
+bool decodePolyline(const QString &encoded, QVector<RoutePoint> &points);
+
+#endif // POLYLINE_H
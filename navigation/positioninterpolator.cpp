@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QtMath>
+
+#include "positioninterpolator.h"
+
+// Extrapolating further past the last sample than this many sample
+// intervals is more likely to be wrong than right (e.g. the vehicle
+// stopped), so the position is blended back to the last sample and
+// held there.  Leaves room for a late sample without stuttering.
+#define EXTRAPOLATION_INTERVALS	2
+
+// Samples further apart than this are not used to estimate movement
+#define MAX_SAMPLE_GAP		5000
+
+// Time (ms) over which a correction from a new sample is blended out
+#define BLEND_TIME		250
+
+// Difference between angles (headings, longitudes), in -180..180
+static double angleDelta(double from, double to)
+{
+	double delta = std::fmod(to - from, 360.0);
+	if (delta > 180.0)
+		delta -= 360.0;
+	else if (delta < -180.0)
+		delta += 360.0;
+	return delta;
+}
+
+static double normalizeHeading(double heading)
+{
+	heading = std::fmod(heading, 360.0);
+	return heading < 0.0 ? heading + 360.0 : heading;
+}
+
+static double normalizeLongitude(double longitude)
+{
+	return angleDelta(0.0, longitude);
+}
+
+void PositionInterpolator::reset()
+{
+	m_valid = false;
+	m_sample_time = -1;
+	m_extrapolation = 0;
+	m_rate = NavigationPosition();
+	m_offset = NavigationPosition();
+}
+
+void PositionInterpolator::addSample(const NavigationPosition &position, qint64 time, qint64 now)
+{
+	if (!m_valid) {
+		m_valid = true;
+		m_sample = position;
+		m_sample_time = time;
+		m_received = now;
+		return;
+	}
+
+	NavigationPosition shown;
+	this->position(now, shown);
+
+	// Prefer the source timestamps, they do not include network and
+	// scheduling jitter.
+	qint64 dt = -1;
+	if (time >= 0 && m_sample_time >= 0)
+		dt = time - m_sample_time;
+	if (dt <= 0)
+		dt = now - m_received;
+
+	if (dt > 0 && dt <= MAX_SAMPLE_GAP) {
+		m_rate.latitude = (position.latitude - m_sample.latitude) / dt;
+		m_rate.longitude = angleDelta(m_sample.longitude, position.longitude) / dt;
+		m_rate.heading = angleDelta(m_sample.heading, position.heading) / dt;
+		m_rate.distance = (position.distance - m_sample.distance) / dt;
+		m_extrapolation = dt * EXTRAPOLATION_INTERVALS;
+	} else {
+		m_rate = NavigationPosition();
+		m_extrapolation = 0;
+	}
+
+	m_sample = position;
+	m_sample_time = time;
+	m_received = now;
+
+	m_offset.latitude = shown.latitude - position.latitude;
+	m_offset.longitude = angleDelta(position.longitude, shown.longitude);
+	m_offset.heading = angleDelta(position.heading, shown.heading);
+	m_offset.distance = shown.distance - position.distance;
+}
+
+NavigationPosition PositionInterpolator::extrapolate(qint64 now) const
+{
+	qint64 since = now - m_received;
+	double elapsed = qBound(qint64(0), since, m_extrapolation);
+	if (since > m_extrapolation)
+		elapsed *= qMax(0.0, 1.0 - double(since - m_extrapolation) / BLEND_TIME);
+
+	NavigationPosition result;
+	result.latitude = m_sample.latitude + m_rate.latitude * elapsed;
+	result.longitude = m_sample.longitude + m_rate.longitude * elapsed;
+	result.heading = m_sample.heading + m_rate.heading * elapsed;
+	result.distance = m_sample.distance + m_rate.distance * elapsed;
+	return result;
+}
+
+bool PositionInterpolator::position(qint64 now, NavigationPosition &result) const
+{
+	if (!m_valid)
+		return false;
+
+	result = extrapolate(now);
+
+	qint64 elapsed = now - m_received;
+	if (elapsed < BLEND_TIME) {
+		double weight = 1.0 - double(qMax(elapsed, qint64(0))) / BLEND_TIME;
+		result.latitude += m_offset.latitude * weight;
+		result.longitude += m_offset.longitude * weight;
+		result.heading += m_offset.heading * weight;
+		result.distance += m_offset.distance * weight;
+	}
+	result.longitude = normalizeLongitude(result.longitude);
+	result.heading = normalizeHeading(result.heading);
+	return true;
+}
+
+bool PositionInterpolator::active(qint64 now) const
+{
+	return m_valid && now - m_received <= m_extrapolation + BLEND_TIME;
+}
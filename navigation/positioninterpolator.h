@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POSITION_INTERPOLATOR_H
+#define POSITION_INTERPOLATOR_H
+
+#include <QtGlobal>
+
+struct NavigationPosition
+{
+	double latitude = 0.0;
+	double longitude = 0.0;
+	double heading = 0.0;	// degrees
+	double distance = 0.0;	// meters
+};
+
+// Dead reckoning from a low rate stream of position samples.  The rate
+// of change is taken from the last two samples using their source
+// timestamps, and positions in between samples are extrapolated from
+// the last one, for up to two sample intervals before going back to
+// it.  Longitudes and headings wrap around.  When a new sample
+// arrives, the difference to what was being shown is blended out over
+// a short time instead of jumping.
+//
+// Times are in ms: sample times on the source clock (or -1 if not
+// known), everything else on a local monotonic clock.
+
+class PositionInterpolator
+{
+public:
+	void reset();
+	void addSample(const NavigationPosition &position, qint64 time, qint64 now);
+
+	// Returns false if there is nothing to show yet
+	bool position(qint64 now, NavigationPosition &result) const;
+
+	// Whether position() still changes, i.e. samples are still
+	// coming in or a correction is still being blended out.
+	bool active(qint64 now) const;
+
+private:
+	NavigationPosition extrapolate(qint64 now) const;
+
+	bool m_valid = false;
+	NavigationPosition m_sample;
+	qint64 m_sample_time = -1;
+	qint64 m_received = 0;
+
+	// Per ms
+	NavigationPosition m_rate;
+	// How long (ms) to extrapolate past the last sample
+	qint64 m_extrapolation = 0;
+
+	// Shown minus extrapolated position when the last sample arrived
+	NavigationPosition m_offset;
+};
+
+#endif // POSITION_INTERPOLATOR_H
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares VisMessageParser with decoding the same frames through
+// QJsonDocument, as was done before it, and checks that both agree.
+//
+// Usage: vis-parser-bench [iterations]
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+#include "vismessageparser.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+// Mostly notifications, as seen by a typical client
+static const char *frames[] = {
+	"{\"action\":\"subscription\",\"subscriptionId\":\"1\",\"data\":{\"path\":\"Vehicle.Speed\",\"dp\":{\"value\":42.5,\"ts\":\"2022-09-01T10:00:00.010Z\"}},\"ts\":\"2022-09-01T10:00:00.010Z\"}",
+	"{\"action\":\"subscription\",\"subscriptionId\":\"2\",\"data\":{\"path\":\"Vehicle.Powertrain.CombustionEngine.Speed\",\"dp\":{\"value\":1520,\"ts\":\"2022-09-01T10:00:00.015Z\"}},\"ts\":\"2022-09-01T10:00:00.015Z\"}",
+	"{\"action\":\"subscription\",\"subscriptionId\":\"3\",\"data\":{\"path\":\"Vehicle.Cabin.Door.Row1.Left.IsOpen\",\"dp\":{\"value\":false,\"ts\":\"2022-09-01T10:00:00.020Z\"}},\"ts\":\"2022-09-01T10:00:00.020Z\"}",
+	"{\"action\":\"subscription\",\"subscriptionId\":\"4\",\"data\":{\"path\":\"Vehicle.Cabin.Infotainment.Media.Played.Title\",\"dp\":{\"value\":\"Caf\\u00e9 \\\"Live\\\"\",\"ts\":\"2022-09-01T10:00:00.025Z\"}},\"ts\":\"2022-09-01T10:00:00.025Z\"}",
+	"{\"action\":\"get\",\"requestId\":\"17\",\"data\":{\"path\":\"Vehicle.CurrentLocation.Latitude\",\"dp\":{\"value\":45.497,\"ts\":\"2022-09-01T10:00:00.030Z\"}},\"ts\":\"2022-09-01T10:00:00.030Z\"}",
+	"{\"action\":\"subscribe\",\"requestId\":\"18\",\"subscriptionId\":\"5\",\"ts\":\"2022-09-01T10:00:00.035Z\"}",
+	"{\"action\":\"set\",\"requestId\":\"19\",\"error\":{\"number\":404,\"reason\":\"not_found\",\"message\":\"Path not found\"},\"ts\":\"2022-09-01T10:00:00.040Z\"}",
+};
+#define FRAME_COUNT int(sizeof(frames) / sizeof(frames[0]))
+
+// The fields VisSession uses, decoded the QJsonDocument way
+static VisMessage parseJson(const QString &frame)
+{
+	VisMessage result;
+	QJsonDocument doc = QJsonDocument::fromJson(frame.toUtf8());
+	QJsonObject obj = doc.object();
+
+	result.action = obj["action"].toString();
+	if (obj.contains("requestId"))
+		result.requestId = obj["requestId"].toVariant().toString().toUInt(&result.hasRequestId);
+	result.subscriptionId = obj["subscriptionId"].toVariant().toString();
+	if (obj.contains("error")) {
+		result.hasError = true;
+		QJsonObject error = obj["error"].toObject();
+		result.error = error["message"].toString();
+	}
+	if (obj["data"].isObject()) {
+		result.hasData = true;
+		QJsonObject data = obj["data"].toObject();
+		result.hasPath = data.contains("path");
+		result.path = data["path"].toString();
+		if (data["dp"].isObject()) {
+			result.hasDatapoint = true;
+			QJsonObject dp = data["dp"].toObject();
+			result.hasValue = dp.contains("value");
+			result.value = dp["value"].toVariant();
+			result.hasTimestamp = dp.contains("ts");
+			result.timestamp = dp["ts"].toString();
+		}
+	}
+	return result;
+}
+
+static bool same(const VisMessage &a, const VisMessage &b)
+{
+	// Numbers are doubles on one side and may be ints on the other
+	return a.action == b.action &&
+		a.hasRequestId == b.hasRequestId && a.requestId == b.requestId &&
+		a.subscriptionId == b.subscriptionId &&
+		a.hasError == b.hasError && a.error == b.error &&
+		a.path == b.path && a.timestamp == b.timestamp &&
+		a.value.toString() == b.value.toString();
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	int iterations = DEFAULT_ITERATIONS;
+	if (app.arguments().size() > 1)
+		iterations = qMax(1, app.arguments()[1].toInt());
+
+	QVector<QString> messages;
+	for (int i = 0; i < FRAME_COUNT; i++)
+		messages.append(QString::fromUtf8(frames[i]));
+
+	VisMessageParser parser;
+	for (const QString &message : messages) {
+		VisMessage result;
+		if (!parser.parse(message, result) || !same(result, parseJson(message))) {
+			qCritical() << "Parsers disagree on" << message;
+			return 1;
+		}
+	}
+
+	// Keep the results alive so nothing is optimized away
+	int checksum = 0;
+	QElapsedTimer clock;
+
+	clock.start();
+	for (int i = 0; i < iterations; i++) {
+		for (const QString &message : messages)
+			checksum += parseJson(message).path.size();
+	}
+	qint64 json_ns = clock.nsecsElapsed();
+
+	clock.start();
+	for (int i = 0; i < iterations; i++) {
+		for (const QString &message : messages) {
+			VisMessage result;
+			parser.parse(message, result);
+			checksum -= result.path.size();
+		}
+	}
+	qint64 parser_ns = clock.nsecsElapsed();
+
+	qint64 count = qint64(iterations) * messages.size();
+	qInfo().noquote() << QString("QJsonDocument:    %1 ns/message").arg(json_ns / count);
+	qInfo().noquote() << QString("VisMessageParser: %1 ns/message (%2x)")
+		.arg(parser_ns / count)
+		.arg(parser_ns > 0 ? double(json_ns) / parser_ns : 0.0, 0, 'f', 1);
+
+	return checksum == 0 ? 0 : 1;
+}
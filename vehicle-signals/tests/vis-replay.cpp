@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a VIS recording through VisMockServer into a VehicleSignals
+// client, and checks that every notification in it arrives.  The time
+// taken is reported, so with a large recording this doubles as an
+// offline benchmark of the client's notification path.
+//
+// Usage: vis-replay <recording> [speed]
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QDebug>
+
+#include "vehiclesignals.h"
+#include "vismockserver.h"
+
+// Give up if the replay has not completed by then
+#define REPLAY_TIMEOUT 30000
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QStringList args = app.arguments();
+	if (args.size() < 2) {
+		qCritical() << "Usage: vis-replay <recording> [speed]";
+		return 2;
+	}
+
+	VisMockServer server;
+	if (!server.load(args[1]))
+		return 1;
+	QStringList paths = server.paths();
+	if (paths.isEmpty()) {
+		qCritical() << "No notifications in" << args[1];
+		return 1;
+	}
+	server.setSpeed(args.size() > 2 ? args[2].toDouble() : 0.0);
+	if (!server.listen())
+		return 1;
+
+	VehicleSignalsConfig config(QStringLiteral("localhost"),
+				    server.port(),
+				    QByteArray(),
+				    QByteArray(),
+				    QByteArray(),
+				    QStringLiteral("token"),
+				    false,
+				    false,
+				    QStringLiteral("websocket-plain"));
+	VehicleSignals vs(config);
+
+	// A single client subscribed to every path gets all of them
+	int expected = server.notificationCount();
+	int received = 0;
+	int sent = -1;
+	QElapsedTimer clock;
+
+	auto check = [&]() {
+		if (sent < 0 || received < qMin(sent, expected))
+			return;
+
+		qint64 elapsed = clock.elapsed();
+		qInfo().noquote() << QString("%1 notifications for %2 paths in %3 ms (%4/s)")
+			.arg(received)
+			.arg(paths.size())
+			.arg(elapsed)
+			.arg(elapsed > 0 ? received * 1000 / elapsed : received);
+		if (sent != expected)
+			qCritical() << "Server sent" << sent << "of" << expected << "notifications";
+		app.exit(received == expected && sent == expected ? 0 : 1);
+	};
+
+	QObject::connect(&vs, &VehicleSignals::connected, &vs, &VehicleSignals::authorize);
+	QObject::connect(&vs, &VehicleSignals::authorized, &vs, [&]() {
+		vs.subscribeMany(paths);
+	});
+	QObject::connect(&vs, &VehicleSignals::signalNotification, &vs,
+			 [&](QString, QVariant, QString) {
+		received++;
+		check();
+	});
+	QObject::connect(&server, &VisMockServer::replayStarted, &server, [&]() {
+		clock.start();
+	});
+	QObject::connect(&server, &VisMockServer::replayFinished, &server,
+			 [&](int notifications, qint64) {
+		sent = notifications;
+		check();
+	});
+	QTimer::singleShot(REPLAY_TIMEOUT, &app, [&]() {
+		qCritical() << "Timed out with" << received << "of"
+			    << expected << "notifications received";
+		app.exit(1);
+	});
+
+	vs.connect();
+	return app.exec();
+}
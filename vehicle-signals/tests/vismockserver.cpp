@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QWebSocket>
+#include <QWebSocketServer>
+
+#include "vismockserver.h"
+#include "vismessageparser.h"
+#include "visrecorder.h"
+
+// Notifications sent per event loop iteration when replaying as fast
+// as possible, so that an in-process client gets to run.
+#define MAX_BATCH 256
+
+VisMockServer::VisMockServer(QObject *parent) :
+	QObject(parent),
+	m_server(Q_NULLPTR),
+	m_secure(false),
+	m_speed(1.0),
+	m_notifications(0),
+	m_next_id(1),
+	m_started(false),
+	m_next_event(0),
+	m_sent(0)
+{
+	m_replay_timer.setSingleShot(true);
+	m_replay_timer.setTimerType(Qt::PreciseTimer);
+	QObject::connect(&m_replay_timer, &QTimer::timeout, this, &VisMockServer::replayNext);
+}
+
+VisMockServer::~VisMockServer()
+{
+	close();
+}
+
+bool VisMockServer::load(const QString &fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qWarning() << "Could not open VIS recording" << fileName << ":" << file.errorString();
+		return false;
+	}
+
+	QByteArray header = file.readLine().trimmed();
+	if (header != VIS_RECORDING_HEADER) {
+		qWarning() << "Not a VIS recording:" << fileName;
+		return false;
+	}
+
+	m_events.clear();
+	m_paths.clear();
+	m_notifications = 0;
+
+	VisMessageParser parser;
+	int lineNumber = 1;
+	while (!file.atEnd()) {
+		QByteArray line = file.readLine();
+		lineNumber++;
+		if (line.startsWith('#') || line.trimmed().isEmpty())
+			continue;
+
+		// <ms> <direction> <frame>
+		int first = line.indexOf(' ');
+		int second = first > 0 ? line.indexOf(' ', first + 1) : -1;
+		bool ok = false;
+		qint64 time = second > 0 ? line.left(first).toLongLong(&ok) : -1;
+		if (!ok) {
+			qWarning() << "Malformed line" << lineNumber << "in VIS recording";
+			continue;
+		}
+
+		// Only what the server sent is replayed, requests are
+		// answered as they come in.
+		if (line.mid(first + 1, second - first - 1) != "<")
+			continue;
+
+		QString frame = QString::fromUtf8(line.mid(second + 1)).trimmed();
+		VisMessage message;
+		if (!parser.parse(frame, message) || message.hasError)
+			continue;
+		if (message.action != "subscription" && message.action != "get")
+			continue;
+		if (!message.hasPath || !message.hasValue || !message.value.isValid())
+			continue;
+
+		Event event;
+		event.time = time;
+		event.path = message.path;
+		event.path.replace(QLatin1Char('/'), QLatin1Char('.'));
+		event.value = message.value;
+		event.timestamp = message.timestamp;
+		if (message.action == "subscription") {
+			event.frame = frame;
+			m_notifications++;
+			if (!m_paths.contains(event.path))
+				m_paths.append(event.path);
+		}
+		m_events.append(event);
+	}
+
+	return true;
+}
+
+void VisMockServer::setSpeed(double speed)
+{
+	m_speed = speed > 0.0 ? speed : 0.0;
+}
+
+void VisMockServer::setSslConfiguration(const QSslConfiguration &config)
+{
+	m_ssl_config = config;
+	m_secure = true;
+}
+
+bool VisMockServer::listen(const QHostAddress &address, quint16 port)
+{
+	close();
+	delete m_server;
+
+	m_server = new QWebSocketServer(QStringLiteral("VisMockServer"),
+					m_secure ? QWebSocketServer::SecureMode : QWebSocketServer::NonSecureMode,
+					this);
+	if (m_secure)
+		m_server->setSslConfiguration(m_ssl_config);
+	QObject::connect(m_server, &QWebSocketServer::newConnection, this, &VisMockServer::onNewConnection);
+
+	if (!m_server->listen(address, port)) {
+		qWarning() << "VisMockServer: could not listen:" << m_server->errorString();
+		return false;
+	}
+	return true;
+}
+
+quint16 VisMockServer::port() const
+{
+	return m_server ? m_server->serverPort() : 0;
+}
+
+void VisMockServer::close()
+{
+	m_replay_timer.stop();
+	m_started = false;
+
+	for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+		QWebSocket *client = it.key();
+		QObject::disconnect(client, nullptr, this, nullptr);
+		client->close();
+		client->deleteLater();
+	}
+	m_clients.clear();
+	m_values.clear();
+
+	if (m_server)
+		m_server->close();
+}
+
+void VisMockServer::onNewConnection()
+{
+	while (m_server->hasPendingConnections()) {
+		QWebSocket *client = m_server->nextPendingConnection();
+		QObject::connect(client, &QWebSocket::textMessageReceived, this, &VisMockServer::onTextMessageReceived);
+		QObject::connect(client, &QWebSocket::disconnected, this, &VisMockServer::onClientDisconnected);
+		m_clients.insert(client, QHash<QString, QString>());
+	}
+}
+
+void VisMockServer::onClientDisconnected()
+{
+	QWebSocket *client = qobject_cast<QWebSocket *>(sender());
+	if (!client)
+		return;
+
+	m_clients.remove(client);
+	client->deleteLater();
+}
+
+void VisMockServer::onTextMessageReceived(const QString &message)
+{
+	QWebSocket *client = qobject_cast<QWebSocket *>(sender());
+	if (!client || !m_clients.contains(client))
+		return;
+
+	QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+	if (!doc.isObject()) {
+		qWarning() << "VisMockServer: received invalid request";
+		return;
+	}
+
+	QJsonObject request = doc.object();
+	QString action = request["action"].toString();
+	// Accept the request id as either a string or a number
+	QString requestId = request["requestId"].toVariant().toString();
+	QString path = request["path"].toString();
+	path.replace(QLatin1Char('/'), QLatin1Char('.'));
+
+	if (action == "authorize") {
+		sendReply(client, action, requestId);
+	} else if (action == "subscribe") {
+		if (path.isEmpty()) {
+			sendError(client, action, requestId, 400, "bad_request", "No path given");
+			return;
+		}
+		QString subscriptionId = QString::number(m_next_id++);
+		m_clients[client].insert(path, subscriptionId);
+
+		QVariantMap members;
+		members["subscriptionId"] = subscriptionId;
+		sendReply(client, action, requestId, members);
+		startReplay();
+	} else if (action == "unsubscribe") {
+		QString subscriptionId = request["subscriptionId"].toVariant().toString();
+		QHash<QString, QString> &subscriptions = m_clients[client];
+		for (auto it = subscriptions.begin(); it != subscriptions.end(); ++it) {
+			if (it.value() == subscriptionId) {
+				subscriptions.erase(it);
+				break;
+			}
+		}
+		sendReply(client, action, requestId);
+	} else if (action == "get") {
+		auto it = m_values.constFind(path);
+		if (it == m_values.constEnd()) {
+			sendError(client, action, requestId, 404, "not_found", "No value for " + path);
+			return;
+		}
+		QVariantMap members;
+		members["data"] = data(path, it.value());
+		sendReply(client, action, requestId, members);
+	} else if (action == "set") {
+		if (path.isEmpty() || !request.contains("value")) {
+			sendError(client, action, requestId, 400, "bad_request", "No path or value given");
+			return;
+		}
+		Value value;
+		value.value = request["value"].toVariant();
+		value.timestamp = QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs);
+		m_values.insert(path, value);
+		sendReply(client, action, requestId);
+		notify(path, value);
+	} else {
+		sendError(client, action, requestId, 400, "bad_request", "Unsupported action");
+	}
+}
+
+void VisMockServer::startReplay()
+{
+	if (m_started || m_events.isEmpty())
+		return;
+
+	// Clients subscribe one path at a time, wait for all of them so
+	// that nothing in the recording is replayed to nobody.
+	for (const QString &path : m_paths) {
+		bool subscribed = false;
+		for (auto it = m_clients.constBegin(); it != m_clients.constEnd() && !subscribed; ++it)
+			subscribed = it.value().contains(path);
+		if (!subscribed)
+			return;
+	}
+
+	m_started = true;
+	m_next_event = 0;
+	m_sent = 0;
+	m_clock.start();
+	emit replayStarted();
+	replayNext();
+}
+
+void VisMockServer::replayNext()
+{
+	qint64 origin = m_events.first().time;
+	int batch = 0;
+	while (m_next_event < m_events.size()) {
+		const Event &event = m_events[m_next_event];
+		if (m_speed > 0.0) {
+			qint64 due = qint64((event.time - origin) / m_speed);
+			qint64 now = m_clock.elapsed();
+			if (due > now) {
+				m_replay_timer.start(int(due - now));
+				return;
+			}
+		} else if (batch == MAX_BATCH) {
+			m_replay_timer.start(0);
+			return;
+		}
+
+		dispatch(event);
+		m_next_event++;
+		batch++;
+	}
+
+	emit replayFinished(m_sent, m_clock.elapsed());
+}
+
+void VisMockServer::dispatch(const Event &event)
+{
+	m_values.insert(event.path, Value{ event.value, event.timestamp });
+	if (event.frame.isEmpty())
+		return;
+
+	for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+		if (it.value().contains(event.path)) {
+			it.key()->sendTextMessage(event.frame);
+			m_sent++;
+		}
+	}
+}
+
+void VisMockServer::notify(const QString &path, const Value &value)
+{
+	QVariantMap notification;
+	notification["action"] = "subscription";
+	notification["data"] = data(path, value);
+	notification["ts"] = value.timestamp;
+
+	for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+		auto subscription = it.value().constFind(path);
+		if (subscription == it.value().constEnd())
+			continue;
+		notification["subscriptionId"] = subscription.value();
+		QJsonDocument doc(QJsonObject::fromVariantMap(notification));
+		it.key()->sendTextMessage(QString::fromUtf8(doc.toJson(QJsonDocument::Compact)));
+	}
+}
+
+void VisMockServer::sendReply(QWebSocket *client, const QString &action, const QString &requestId,
+			      const QVariantMap &members)
+{
+	QVariantMap reply = members;
+	reply["action"] = action;
+	reply["requestId"] = requestId;
+	reply["ts"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs);
+
+	QJsonDocument doc(QJsonObject::fromVariantMap(reply));
+	client->sendTextMessage(QString::fromUtf8(doc.toJson(QJsonDocument::Compact)));
+}
+
+void VisMockServer::sendError(QWebSocket *client, const QString &action, const QString &requestId,
+			      int number, const QString &reason, const QString &message)
+{
+	// Same layout as KUKSA.val errors
+	QVariantMap error;
+	error["number"] = number;
+	error["reason"] = reason;
+	error["message"] = message;
+
+	QVariantMap members;
+	members["error"] = error;
+	sendReply(client, action, requestId, members);
+}
+
+QVariantMap VisMockServer::data(const QString &path, const Value &value) const
+{
+	QVariantMap dp;
+	dp["value"] = value.value;
+	dp["ts"] = value.timestamp;
+
+	QVariantMap data;
+	data["path"] = path;
+	data["dp"] = dp;
+	return data;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_MOCK_SERVER_H
+#define VIS_MOCK_SERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QVariant>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QSslConfiguration>
+
+class QWebSocketServer;
+class QWebSocket;
+
+// In-process stand-in for a KUKSA.val server speaking VIS v1 JSON over
+// a websocket, for exercising VehicleSignals users without a server or
+// credentials.  Notifications are replayed from a recording made with
+// the vis-client/record setting (see VehicleSignalsConfig::recordFile),
+// starting once every path in it has been subscribed to.
+//
+// Requests are answered locally: authorize always succeeds, get returns
+// the latest value replayed or set, and set updates the value and
+// notifies subscribers like the real server does.
+//
+// Clients connect with the "websocket-plain" transport, or with
+// "websocket" if an SSL configuration has been set before listen().
+
+class VisMockServer : public QObject
+{
+	Q_OBJECT
+
+public:
+	explicit VisMockServer(QObject *parent = Q_NULLPTR);
+	virtual ~VisMockServer();
+
+	bool load(const QString &fileName);
+
+	// Replay speed relative to the recording, e.g. 1 or 10, or 0 to
+	// replay as fast as possible.
+	void setSpeed(double speed);
+	double speed() const { return m_speed; };
+
+	void setSslConfiguration(const QSslConfiguration &config);
+
+	bool listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 0);
+	quint16 port() const;
+	void close();
+
+	// Number of notifications in the loaded recording
+	int notificationCount() const { return m_notifications; };
+	// Paths with notifications in the loaded recording
+	QStringList paths() const { return m_paths; };
+
+signals:
+	void replayStarted();
+	// elapsed is in ms since the replay started
+	void replayFinished(int notifications, qint64 elapsed);
+
+private slots:
+	void onNewConnection();
+	void onTextMessageReceived(const QString &message);
+	void onClientDisconnected();
+	void replayNext();
+
+private:
+	// Notification or value from the recording
+	struct Event {
+		qint64 time;
+		QString path;
+		QVariant value;
+		QString timestamp;
+		// Notification to send as recorded, empty for values from
+		// get replies.  Clients dispatch notifications by path, so
+		// the recorded subscription id does not need to match.
+		QString frame;
+	};
+
+	struct Value {
+		QVariant value;
+		QString timestamp;
+	};
+
+	QWebSocketServer *m_server;
+	QSslConfiguration m_ssl_config;
+	bool m_secure;
+	double m_speed;
+
+	QVector<Event> m_events;
+	QStringList m_paths;
+	int m_notifications;
+	unsigned int m_next_id;
+
+	// Subscribed paths and subscription ids of each client
+	QHash<QWebSocket *, QHash<QString, QString>> m_clients;
+	QHash<QString, Value> m_values;
+
+	bool m_started;
+	int m_next_event;
+	int m_sent;
+	QElapsedTimer m_clock;
+	QTimer m_replay_timer;
+
+	void startReplay();
+	void dispatch(const Event &event);
+	void notify(const QString &path, const Value &value);
+	void sendReply(QWebSocket *client, const QString &action, const QString &requestId,
+		       const QVariantMap &members = QVariantMap());
+	void sendError(QWebSocket *client, const QString &action, const QString &requestId,
+		       int number, const QString &reason, const QString &message);
+	QVariantMap data(const QString &path, const Value &value) const;
+};
+
+#endif // VIS_MOCK_SERVER_H
@@ -16,56 +16,171 @@
 
 #include <QDebug>
 #include <QSettings>
-#include <QUrl>
 #include <QFile>
-#include <QSslKey>
-#include <QTimer>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QTextStream>
+#include <QMutex>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QSslCertificate>
 #include <QVariantMap>
-#include <QJsonDocument>
-#include <QJsonObject>
 
 #include "vehiclesignals.h"
+#include "vissession.h"
 
 #define DEFAULT_CLIENT_KEY_FILE  "/etc/kuksa-val/Client.key"
 #define DEFAULT_CLIENT_CERT_FILE "/etc/kuksa-val/Client.pem"
 #define DEFAULT_CA_CERT_FILE     "/etc/kuksa-val/CA.pem"
 
+// Config state shared by copies of a VehicleSignalsConfig.  For configs
+// read from an app's settings, the fields are filled in by a thread
+// pool job, and are only accessed once it has finished.
+class VehicleSignalsConfigData
+{
+public:
+	QString appname;
+	// Protects starting the job
+	QMutex mutex;
+	bool started = false;
+	QFuture<void> loading;
+
+	QString hostname;
+	unsigned port = 0;
+	QByteArray clientKey;
+	QByteArray clientCert;
+	QByteArray caCert;
+	QString authToken;
+	bool verifyPeer = false;
+	QString tlsServerName;
+	bool threaded = false;
+	QString transport;
+	QString recordFile;
+	bool valid = false;
+	unsigned verbose = 0;
+
+	void load();
+};
+
+// Credential files read so far in this process, only re-read if they
+// have been modified since.
+struct CachedFile
+{
+	QDateTime modified;
+	qint64 size = -1;
+	QByteArray data;
+	// Result of parsing as CA certificate, -1 if not done yet
+	int validCaCert = -1;
+};
+
+// Configs of each app, shared while in use
+static QMutex s_configs_mutex;
+static QHash<QString, QWeakPointer<VehicleSignalsConfigData>> s_configs;
+
+static QMutex s_files_mutex;
+static QHash<QString, CachedFile> s_files;
+
+static bool readCachedFile(const QString &fileName, QByteArray &data)
+{
+	QFileInfo info(fileName);
+	if (!info.exists())
+		return false;
+
+	{
+		QMutexLocker locker(&s_files_mutex);
+		auto it = s_files.constFind(fileName);
+		if (it != s_files.cend() &&
+		    it->modified == info.lastModified() && it->size == info.size()) {
+			data = it->data;
+			return true;
+		}
+	}
+
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	CachedFile entry;
+	entry.modified = info.lastModified();
+	entry.size = info.size();
+	entry.data = file.readAll();
+	data = entry.data;
+
+	QMutexLocker locker(&s_files_mutex);
+	s_files.insert(fileName, entry);
+	return true;
+}
+
+static bool isValidCaCert(const QString &fileName, const QByteArray &data)
+{
+	{
+		QMutexLocker locker(&s_files_mutex);
+		auto it = s_files.constFind(fileName);
+		if (it != s_files.cend() && it->data == data && it->validCaCert >= 0)
+			return it->validCaCert != 0;
+	}
+
+	bool valid = !QSslCertificate::fromData(data).isEmpty();
+
+	QMutexLocker locker(&s_files_mutex);
+	auto it = s_files.find(fileName);
+	if (it != s_files.end() && it->data == data)
+		it->validCaCert = valid;
+	return valid;
+}
+
 VehicleSignalsConfig::VehicleSignalsConfig(const QString &hostname,
 					   const unsigned port,
 					   const QByteArray &clientKey,
 					   const QByteArray &clientCert,
 					   const QByteArray &caCert,
 					   const QString &authToken,
-					   bool verifyPeer) :
-	m_hostname(hostname),
-	m_port(port),
-	m_clientKey(clientKey),
-	m_clientCert(clientCert),
-	m_caCert(caCert),
-	m_authToken(authToken),
-	m_verifyPeer(verifyPeer),
-	m_verbose(0),
-	m_valid(true)
+					   bool verifyPeer,
+					   bool threaded,
+					   const QString &transport,
+					   const QString &tlsServerName) :
+	d(new VehicleSignalsConfigData)
 {
+	d->hostname = hostname;
+	d->port = port;
+	d->clientKey = clientKey;
+	d->clientCert = clientCert;
+	d->caCert = caCert;
+	d->authToken = authToken;
+	d->verifyPeer = verifyPeer;
+	d->tlsServerName = tlsServerName;
+	d->threaded = threaded;
+	d->transport = transport;
+	d->verbose = 0;
+	d->valid = true;
+
 	// Potentially could do some certificate validation here...
 }
 
 VehicleSignalsConfig::VehicleSignalsConfig(const QString &appname)
 {
-	m_valid = false;
+	QMutexLocker locker(&s_configs_mutex);
+	d = s_configs.value(appname).toStrongRef();
+	if (!d) {
+		d.reset(new VehicleSignalsConfigData);
+		d->appname = appname;
+		s_configs.insert(appname, d);
+	}
+}
 
-	QSettings *pSettings = new QSettings("AGL", appname);
-	if (!pSettings)
-		return;
+void VehicleSignalsConfigData::load()
+{
+	QSettings settings("AGL", appname);
 
-	m_hostname = pSettings->value("vis-client/server", "localhost").toString();
-	if (m_hostname.isEmpty()) {
+	hostname = settings.value("vis-client/server", "localhost").toString();
+	if (hostname.isEmpty()) {
 		qCritical() << "Invalid server hostname";
 		return;
 	}
 
-	m_port = pSettings->value("vis-client/port", 8090).toInt();
-	if (m_port == 0) {
+	port = settings.value("vis-client/port", 8090).toInt();
+	if (port == 0) {
 		qCritical() << "Invalid server port";
 		return;
 	}
@@ -75,353 +190,443 @@ VehicleSignalsConfig::VehicleSignalsConfig(const QString &appname)
 	// testing.  Wrangling server and CA certificate generation
 	// and management to be able to verify will require further
 	// investigation.
-	m_verifyPeer = pSettings->value("vis-client/verify-server", false).toBool();
+	verifyPeer = settings.value("vis-client/verify-server", false).toBool();
+	tlsServerName = settings.value("vis-client/tls-server-name").toString();
+
+	// Optionally keep TLS and message decoding off the GUI thread
+	threaded = settings.value("vis-client/threaded", false).toBool();
+
+	transport = settings.value("vis-client/transport", "websocket").toString();
 
-	QString keyFileName = pSettings->value("vis-client/key", DEFAULT_CLIENT_KEY_FILE).toString();
+	// Optionally record the VIS traffic for replaying with VisMockServer
+	recordFile = settings.value("vis-client/record").toString();
+
+	QString keyFileName = settings.value("vis-client/key", DEFAULT_CLIENT_KEY_FILE).toString();
 	if (keyFileName.isEmpty()) {
 		qCritical() << "Invalid client key filename";
 		return;
 	}
-	QFile keyFile(keyFileName);
-	if (!keyFile.open(QIODevice::ReadOnly)) {
+	QByteArray keyData;
+	if (!readCachedFile(keyFileName, keyData)) {
 		qCritical() << "Could not open client key file";
 		return;
 	}
-	QByteArray keyData = keyFile.readAll();
 	if (keyData.isEmpty()) {
 		qCritical() << "Invalid client key file";
 		return;
 	}
-	m_clientKey = keyData;
+	clientKey = keyData;
 
-	QString certFileName = pSettings->value("vis-client/certificate", DEFAULT_CLIENT_CERT_FILE).toString();
+	QString certFileName = settings.value("vis-client/certificate", DEFAULT_CLIENT_CERT_FILE).toString();
 	if (certFileName.isEmpty()) {
 		qCritical() << "Invalid client certificate filename";
 		return;
 	}
-	QFile certFile(certFileName);
-	if (!certFile.open(QIODevice::ReadOnly)) {
+	QByteArray certData;
+	if (!readCachedFile(certFileName, certData)) {
 		qCritical() << "Could not open client certificate file";
 		return;
 	}
-	QByteArray certData = certFile.readAll();
 	if (certData.isEmpty()) {
 		qCritical() << "Invalid client certificate file";
 		return;
 	}
-	m_clientCert = certData;
+	clientCert = certData;
 
-	QString caCertFileName = pSettings->value("vis-client/ca-certificate", DEFAULT_CA_CERT_FILE).toString();
+	QString caCertFileName = settings.value("vis-client/ca-certificate", DEFAULT_CA_CERT_FILE).toString();
 	if (caCertFileName.isEmpty()) {
 		qCritical() << "Invalid CA certificate filename";
 		return;
 	}
-	QFile caCertFile(caCertFileName);
-	if (!caCertFile.open(QIODevice::ReadOnly)) {
+	QByteArray caCertData;
+	if (!readCachedFile(caCertFileName, caCertData)) {
 		qCritical() << "Could not open CA certificate file";
 		return;
 	}
-	QByteArray caCertData = caCertFile.readAll();
 	if (caCertData.isEmpty()) {
 		qCritical() << "Invalid CA certificate file";
 		return;
 	}
 	// Pre-check CA certificate
-	QList<QSslCertificate> newSslCaCerts = QSslCertificate::fromData(caCertData);
-	if (newSslCaCerts.isEmpty()) {
+	if (!isValidCaCert(caCertFileName, caCertData)) {
 		qCritical() << "Invalid CA certificate";
 		return;
 	}
-	m_caCert = caCertData;
+	caCert = caCertData;
 
-	QString authTokenFileName = pSettings->value("vis-client/authorization").toString();
+	QString authTokenFileName = settings.value("vis-client/authorization").toString();
 	if (authTokenFileName.isEmpty()) {
 		qCritical() << "Invalid authorization token filename";
 		return;
 	}
-	QFile authTokenFile(authTokenFileName);
-	if (!authTokenFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+	QByteArray authTokenData;
+	if (!readCachedFile(authTokenFileName, authTokenData)) {
 		qCritical() << "Could not open authorization token file";
 		return;
 	}
-	QTextStream in(&authTokenFile);
-	QString authToken = in.readLine();
-	if (authToken.isEmpty()) {
+	QTextStream in(&authTokenData, QIODevice::ReadOnly | QIODevice::Text);
+	QString token = in.readLine();
+	if (token.isEmpty()) {
 		qCritical() << "Invalid authorization token file";
 		return;
 	}
-	m_authToken = authToken;
-
-	m_verbose = 0;
-	QString verbose = pSettings->value("vis-client/verbose").toString();
-	if (!verbose.isEmpty()) {
-		if (verbose == "true" || verbose == "1")
-			m_verbose = 1;
-		if (verbose == "2")
-			m_verbose = 2;
+	authToken = token;
+
+	verbose = 0;
+	QString verboseSetting = settings.value("vis-client/verbose").toString();
+	if (!verboseSetting.isEmpty()) {
+		if (verboseSetting == "true" || verboseSetting == "1")
+			verbose = 1;
+		if (verboseSetting == "2")
+			verbose = 2;
 	}
 
-	m_valid = true;
+	valid = true;
 }
 
-VehicleSignals::VehicleSignals(const VehicleSignalsConfig &config, QObject *parent) :
-	QObject(parent),
-	m_config(config),
-	m_request_id(0)
+void VehicleSignalsConfig::startLoading()
 {
-	QObject::connect(&m_websocket, &QWebSocket::connected, this, &VehicleSignals::onConnected);
-	QObject::connect(&m_websocket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error),
-			 this, &VehicleSignals::onError);
-	QObject::connect(&m_websocket, &QWebSocket::disconnected, this, &VehicleSignals::onDisconnected);
+	if (d->appname.isEmpty())
+		return;
+
+	QMutexLocker locker(&d->mutex);
+	if (d->started)
+		return;
+	d->started = true;
+
+	// Keep settings and credential file reads off the caller's
+	// (typically the GUI) thread, the data is kept alive by the job.
+	QSharedPointer<VehicleSignalsConfigData> data = d;
+	d->loading = QtConcurrent::run([data]() {
+		data->load();
+	});
 }
 
-VehicleSignals::~VehicleSignals()
+void VehicleSignalsConfig::wait()
 {
-	m_websocket.close();
+	startLoading();
+	d->loading.waitForFinished();
 }
 
-void VehicleSignals::connect()
+bool VehicleSignalsConfig::isLoaded()
 {
-	if (!m_config.valid()) {
-		qCritical() << "Invalid VIS server configuration";
+	startLoading();
+	return d->loading.isFinished();
+}
+
+void VehicleSignalsConfig::whenLoaded(QObject *context, std::function<void()> callback)
+{
+	if (isLoaded()) {
+		callback();
 		return;
 	}
 
-	QUrl visUrl;
-	visUrl.setScheme(QStringLiteral("wss"));
-	visUrl.setHost(m_config.hostname());
-	visUrl.setPort(m_config.port());
+	QFutureWatcher<void> *watcher = new QFutureWatcher<void>(context);
+	QObject::connect(watcher, &QFutureWatcher<void>::finished, context, [watcher, callback]() {
+		watcher->deleteLater();
+		callback();
+	});
+	watcher->setFuture(d->loading);
+}
 
-	QSslConfiguration sslConfig = QSslConfiguration::defaultConfiguration();
+QString VehicleSignalsConfig::key()
+{
+	// Known without waiting for settings to be loaded, so that
+	// VehicleSignals objects can be created without blocking.
+	if (!d->appname.isEmpty())
+		return QStringLiteral("app:") + d->appname;
+
+	return QString("%1:%2:%3:%4:%5:%6:%7").arg(d->transport)
+					      .arg(d->hostname)
+					      .arg(d->port)
+					      .arg(d->verifyPeer)
+					      .arg(d->tlsServerName)
+					      .arg(d->threaded)
+					      .arg(d->authToken);
+}
 
-	// Add client private key
-        // i.e. kuksa_certificates/Client.key in source tree
-	QSslKey sslKey(m_config.clientKey(), QSsl::Rsa);
-	sslConfig.setPrivateKey(sslKey);
+QString VehicleSignalsConfig::hostname() { wait(); return d->hostname; }
+unsigned VehicleSignalsConfig::port() { wait(); return d->port; }
+QByteArray VehicleSignalsConfig::clientKey() { wait(); return d->clientKey; }
+QByteArray VehicleSignalsConfig::clientCert() { wait(); return d->clientCert; }
+QByteArray VehicleSignalsConfig::caCert() { wait(); return d->caCert; }
+QString VehicleSignalsConfig::authToken() { wait(); return d->authToken; }
+bool VehicleSignalsConfig::verifyPeer() { wait(); return d->verifyPeer; }
+QString VehicleSignalsConfig::tlsServerName() { wait(); return d->tlsServerName; }
+bool VehicleSignalsConfig::threaded() { wait(); return d->threaded; }
+QString VehicleSignalsConfig::transport() { wait(); return d->transport; }
+QString VehicleSignalsConfig::recordFile() { wait(); return d->recordFile; }
+bool VehicleSignalsConfig::valid() { wait(); return d->valid; }
+unsigned VehicleSignalsConfig::verbose() { wait(); return d->verbose; }
 
-	// Add local client certificate
-        // i.e. kuksa_certificates/Client.pem in source tree
-	QList<QSslCertificate> sslCerts = QSslCertificate::fromData(m_config.clientCert());
-	if (sslCerts.empty()) {
-		qCritical() << "Invalid client certificate";
-		return; 
-	}
-	sslConfig.setLocalCertificate(sslCerts.first());
-
-	// Add CA certificate
-        // i.e. kuksa_certificates/CA.pem in source tree
-	// Note the following can be simplified with QSslConfiguration::addCaCertificate with Qt 5.15
-	QList<QSslCertificate> sslCaCerts = sslConfig.caCertificates();
-	QList<QSslCertificate> newSslCaCerts = QSslCertificate::fromData(m_config.caCert());
-	if (newSslCaCerts.empty()) {
-		qCritical() << "Invalid CA certificate";
-		return;
-	}
-	sslCaCerts.append(newSslCaCerts.first());
-	sslConfig.setCaCertificates(sslCaCerts);
+VehicleSignals::VehicleSignals(const VehicleSignalsConfig &config, QObject *parent) :
+	QObject(parent),
+	m_filter_timer_due(-1)
+{
+	m_clock.start();
+	m_filter_timer.setSingleShot(true);
+	QObject::connect(&m_filter_timer, &QTimer::timeout, this, &VehicleSignals::onFilterTimeout);
+
+	m_session = VisSession::acquire(config);
+	m_session->attach(this);
+}
+
+VehicleSignals::~VehicleSignals()
+{
+	m_session->detach(this);
+}
+
+void VehicleSignals::connect()
+{
+	m_session->open(this);
+}
 
-	sslConfig.setPeerVerifyMode(m_config.verifyPeer() ? QSslSocket::VerifyPeer : QSslSocket::VerifyNone);
+void VehicleSignals::authorize()
+{
+	m_session->authorize(this);
+}
 
-	m_websocket.setSslConfiguration(sslConfig);
+unsigned int VehicleSignals::get(const QString &path)
+{
+	return get(path, nullptr);
+}
 
-	if (m_config.verbose())
-		qInfo() << "Opening VIS websocket";
-	m_websocket.open(visUrl);
+unsigned int VehicleSignals::get(const QString &path, int maxAge)
+{
+	return get(path, nullptr, VIS_REQUEST_TIMEOUT, maxAge);
 }
 
-void VehicleSignals::onConnected()
+unsigned int VehicleSignals::get(const QString &path, VehicleSignalsCallback callback, int timeout, int maxAge)
 {
-	if (m_config.verbose() > 1)
-		qDebug() << "VehicleSignals::onConnected: enter";
-	QObject::connect(&m_websocket, &QWebSocket::textMessageReceived, this, &VehicleSignals::onTextMessageReceived);
-	emit connected();
+	return m_session->get(this, path, callback, timeout, maxAge);
 }
 
-void VehicleSignals::onError(QAbstractSocket::SocketError error)
+unsigned int VehicleSignals::set(const QString &path, const QVariant &value)
 {
-	if (m_config.verbose() > 1)
-		qDebug() << "VehicleSignals::onError: enter";
-	QTimer::singleShot(1000, this, &VehicleSignals::reconnect);
+	return set(path, value, nullptr);
 }
 
-void VehicleSignals::reconnect()
+unsigned int VehicleSignals::set(const QString &path, const QVariant &value, VehicleSignalsCallback callback, int timeout)
 {
-	if (m_config.verbose() > 1)
-		qDebug() << "VehicleSignals::reconnect: enter";
-	connect();
+	return m_session->set(this, path, value, callback, timeout);
 }
 
-void VehicleSignals::onDisconnected()
+unsigned int VehicleSignals::subscribe(const QString &path)
 {
-	if (m_config.verbose() > 1)
-		qDebug() << "VehicleSignals::onDisconnected: enter";
-	QObject::disconnect(&m_websocket, &QWebSocket::textMessageReceived, this, &VehicleSignals::onTextMessageReceived);
-	emit disconnected();
+	return subscribe(path, nullptr);
+}
 
-	// Try to reconnect
-	QTimer::singleShot(1000, this, &VehicleSignals::reconnect);
+unsigned int VehicleSignals::subscribe(const QString &path, VehicleSignalsCallback callback, int timeout)
+{
+	return m_session->subscribe(this, path, callback, timeout);
 }
 
-void VehicleSignals::authorize()
+unsigned int VehicleSignals::subscribe(const QString &path,
+				       const VehicleSignalsSubscribeOptions &options,
+				       VehicleSignalsCallback callback,
+				       int timeout)
 {
-	QVariantMap map;
-	map["action"] = QString("authorize");
-	map["tokens"] = m_config.authToken();
-	map["requestId"] = QString::number(m_request_id++);
-	QJsonDocument doc = QJsonDocument::fromVariant(map);
-	m_websocket.sendTextMessage(doc.toJson(QJsonDocument::Compact).data());
+	setSubscribeOptions(path, options);
+	return m_session->subscribe(this, path, callback, timeout);
 }
 
-void VehicleSignals::get(const QString &path)
+void VehicleSignals::getMany(const QStringList &paths)
 {
-	QVariantMap map;
-	map["action"] = QString("get");
-	map["tokens"] = m_config.authToken();
-	map["path"] = path;
-	map["requestId"] = QString::number(m_request_id++);
-	QJsonDocument doc = QJsonDocument::fromVariant(map);
-	m_websocket.sendTextMessage(doc.toJson(QJsonDocument::Compact).data());
+	for (const auto &path : paths)
+		m_session->queueGet(this, path);
 }
 
-void VehicleSignals::set(const QString &path, const QString &value)
+void VehicleSignals::setMany(const QVariantMap &values)
 {
-	QVariantMap map;
-	map["action"] = QString("set");
-	map["tokens"] = m_config.authToken();
-	map["path"] = path;
-	map["value"] = value;
-	map["requestId"] = QString::number(m_request_id++);
-	QJsonDocument doc = QJsonDocument::fromVariant(map);
-	m_websocket.sendTextMessage(doc.toJson(QJsonDocument::Compact).data());
+	for (auto it = values.cbegin(); it != values.cend(); ++it)
+		m_session->queueSet(this, it.key(), it.value());
 }
 
-void VehicleSignals::subscribe(const QString &path)
+void VehicleSignals::subscribeMany(const QStringList &paths)
 {
-	QVariantMap map;
-	map["action"] = QString("subscribe");
-	map["tokens"] = m_config.authToken();
-	map["path"] = path;
-	map["requestId"] = QString::number(m_request_id++);
-	QJsonDocument doc = QJsonDocument::fromVariant(map);
-	m_websocket.sendTextMessage(doc.toJson(QJsonDocument::Compact).data());
+	for (const auto &path : paths)
+		m_session->queueSubscribe(this, path);
 }
 
-bool VehicleSignals::parseData(const QJsonObject &response, QString &path, QString &value, QString &timestamp)
+void VehicleSignals::subscribeMany(const QStringList &paths, const VehicleSignalsSubscribeOptions &options)
 {
-	if (response.contains("error")) {
-		QString error = response.value("error").toString();
-		return false;
+	for (const auto &path : paths) {
+		setSubscribeOptions(path, options);
+		m_session->queueSubscribe(this, path);
 	}
+}
 
-	if (!(response.contains("data") && response["data"].isObject())) {
-		qWarning() << "Malformed response (data missing)";
-		return false;
-	}
-	QJsonObject data = response["data"].toObject();
-	if (!(data.contains("path") && data["path"].isString())) {
-		qWarning() << "Malformed response (path missing)";
-		return false;
+void VehicleSignals::setSubscribeOptions(const QString &path, const VehicleSignalsSubscribeOptions &options)
+{
+	int id = pathId(path);
+	if (options.minInterval <= 0 && options.deadband <= 0.0 && !options.latestOnly) {
+		// Unfiltered, flush anything being held back
+		auto it = m_filters.find(id);
+		if (it == m_filters.end())
+			return;
+		SignalFilter filter = it.value();
+		m_filters.erase(it);
+		if (filter.pending)
+			dispatchNotification(id, filter.path, filter.pendingValue, filter.pendingTimestamp);
+		return;
 	}
-	path = data["path"].toString();
-	// Convert '/' to '.' in paths to ensure consistency for clients
-	path.replace(QString("/"), QString("."));
 
-	if (!(data.contains("dp") && data["dp"].isObject())) {
-		qWarning() << "Malformed response (datapoint missing)";
-		return false;
-	}
-	QJsonObject dp = data["dp"].toObject();
-	if (!dp.contains("value")) {
-		qWarning() << "Malformed response (value missing)";
-		return false;
-	} else if (dp["value"].isString()) {
-		value = dp["value"].toString();
-	} else if (dp["value"].isDouble()) {
-		value = QString::number(dp["value"].toDouble(), 'f', 9);
-	} else if (dp["value"].isBool()) {
-		value = dp["value"].toBool() ? "true" : "false";
-	} else {
-		qWarning() << "Malformed response (unsupported value type)";
-		return false;
+	// Keep the delivery history if only the options change
+	SignalFilter &filter = m_filters[id];
+	filter.options = options;
+	filter.path = path;
+}
+
+int VehicleSignals::pathId(const QString &path)
+{
+	return m_session->pathId(path);
+}
+
+int VehicleSignals::addSignalHandler(const QString &path, QObject *context, VehicleSignalsHandler handler)
+{
+	int id = pathId(path);
+	if (handler) {
+		if (id >= m_handlers.size())
+			m_handlers.resize(id + 1);
+
+		SignalHandler entry;
+		entry.context = context ? context : this;
+		entry.handler = handler;
+		m_handlers[id].append(entry);
 	}
+	return id;
+}
 
-	if (!(dp.contains("ts") && dp["ts"].isString())) {
-		qWarning() << "Malformed response (timestamp missing)";
-		return false;
+void VehicleSignals::removeSignalHandlers(QObject *context)
+{
+	for (auto &handlers : m_handlers) {
+		for (int i = handlers.size() - 1; i >= 0; i--) {
+			if (handlers[i].context == context)
+				handlers.remove(i);
+		}
 	}
-	timestamp = dp["ts"].toString();
+}
 
-	return true;
+bool VehicleSignals::cachedValue(const QString &path, QVariant &value, QString &timestamp, qint64 *age)
+{
+	return m_session->cachedValue(path, value, timestamp, age);
 }
 
-//
-// NOTE:
-//
-// Ideally request ids would be used to provide some form of mapping
-// to callers of get/set for responses/errors.  At present the demo
-// usecases are simple enough that it does not seem worth implementing
-// just yet.
-//
-void VehicleSignals::onTextMessageReceived(QString msg)
-{
-	msg = msg.simplified();
-	QJsonDocument doc(QJsonDocument::fromJson(msg.toUtf8()));
-	if (doc.isEmpty()) {
-		qWarning() << "Received invalid JSON: empty VIS message";
+VehicleSignalsConnectionStats VehicleSignals::connectionStats()
+{
+	return m_session->connectionStats();
+}
+
+void VehicleSignals::deliverNotification(int id, const QString &path, const QVariant &value, const QString &timestamp)
+{
+	auto it = m_filters.find(id);
+	if (it == m_filters.end()) {
+		dispatchNotification(id, path, value, timestamp);
 		return;
 	}
 
-	if (!doc.isObject()) {
-		qWarning() << "Received invalid JSON: malformed VIS message";
+	SignalFilter &filter = it.value();
+	const VehicleSignalsSubscribeOptions &options = filter.options;
+	if (options.deadband > 0.0 && filter.delivered &&
+	    value.userType() == QMetaType::Double &&
+	    filter.lastValue.userType() == QMetaType::Double &&
+	    qAbs(value.toDouble() - filter.lastValue.toDouble()) < options.deadband) {
+		// Back within the deadband of what was last delivered, so
+		// anything held back is no longer a change worth reporting.
+		filter.pending = false;
 		return;
 	}
-	QJsonObject obj = doc.object();
 
-	if (!obj.contains("action")) {
-		qWarning() << "Received unknown message (no action), discarding";
+	qint64 now = m_clock.elapsed();
+	qint64 due = now;
+	if (options.minInterval > 0 && filter.lastTime >= 0)
+		due = qMax(now, filter.lastTime + options.minInterval);
+
+	if (due <= now && !options.latestOnly) {
+		filter.delivered = true;
+		filter.lastValue = value;
+		filter.lastTime = now;
+		dispatchNotification(id, path, value, timestamp);
 		return;
 	}
-	
-	QString action = obj.value("action").toString();
-	if (action == "authorize") {
-		if (obj.contains("error")) {
-			QString error = obj.value("error").toString();
-			qWarning() << "VIS authorization failed: " << error;
-		} else {
-			if (m_config.verbose() > 1)
-				qDebug() << "authorized";
-			emit authorized();
-		}
-	} else if (action == "subscribe") {
-		if (obj.contains("error")) {
-			QString error = obj.value("error").toString();
-			qWarning() << "VIS subscription failed: " << error;
-		}
-	} else if (action == "get") {
-		if (obj.contains("error")) {
-			QString error = obj.value("error").toString();
-			qWarning() << "VIS get failed: " << error;
-		} else {
-			QString path, value, ts;
-			if (parseData(obj, path, value, ts)) {
-				if (m_config.verbose() > 1)
-					qDebug() << "VehicleSignals::onTextMessageReceived: emitting response" << path << " = " << value;
-				emit getSuccessResponse(path, value, ts);
+
+	// Hold back, replacing any earlier update still pending
+	filter.pending = true;
+	filter.pendingValue = value;
+	filter.pendingTimestamp = timestamp;
+	filter.due = due;
+	armFilterTimer(due);
+}
+
+void VehicleSignals::armFilterTimer(qint64 due)
+{
+	if (m_filter_timer.isActive() && m_filter_timer_due <= due)
+		return;
+
+	m_filter_timer_due = due;
+	m_filter_timer.start(static_cast<int>(qMax<qint64>(0, due - m_clock.elapsed())));
+}
+
+void VehicleSignals::onFilterTimeout()
+{
+	qint64 now = m_clock.elapsed();
+	QList<int> ready;
+	qint64 next = -1;
+	for (auto it = m_filters.cbegin(); it != m_filters.cend(); ++it) {
+		if (!it->pending)
+			continue;
+		if (it->due <= now)
+			ready.append(it.key());
+		else if (next < 0 || it->due < next)
+			next = it->due;
+	}
+
+	m_filter_timer_due = -1;
+	if (next >= 0)
+		armFilterTimer(next);
+
+	for (int id : ready) {
+		// Handlers may have changed the filters
+		auto it = m_filters.find(id);
+		if (it == m_filters.end() || !it->pending)
+			continue;
+
+		SignalFilter &filter = it.value();
+		filter.pending = false;
+		filter.delivered = true;
+		filter.lastValue = filter.pendingValue;
+		filter.lastTime = now;
+		QString path = filter.path;
+		QVariant value = filter.pendingValue;
+		QString timestamp = filter.pendingTimestamp;
+		dispatchNotification(id, path, value, timestamp);
+	}
+}
+
+void VehicleSignals::dispatchNotification(int id, const QString &path, const QVariant &value, const QString &timestamp)
+{
+	if (id < m_handlers.size() && !m_handlers[id].isEmpty()) {
+		// Work on a (shared) copy, handlers may add or remove handlers
+		QVector<SignalHandler> handlers = m_handlers[id];
+		bool stale = false;
+		for (const auto &handler : handlers) {
+			if (handler.context.isNull()) {
+				stale = true;
+				continue;
 			}
+			handler.handler(value, timestamp);
 		}
-	} else if (action == "set") {
-		if (obj.contains("error")) {
-			QString error = obj.value("error").toString();
-			qWarning() << "VIS set failed: " << error;
-		}
-	} else if (action == "subscription") {
-		QString path, value, ts;
-		if (parseData(obj, path, value, ts)) {
-			if (m_config.verbose() > 1)
-				qDebug() << "VehicleSignals::onTextMessageReceived: emitting notification" << path << " = " << value;
-			emit signalNotification(path, value, ts);
+
+		if (stale) {
+			QVector<SignalHandler> &current = m_handlers[id];
+			for (int i = current.size() - 1; i >= 0; i--) {
+				if (current[i].context.isNull())
+					current.remove(i);
+			}
 		}
-	} else {
-		qWarning() << "unhandled VIS response of type: " << action;
 	}
+
+	if (m_session->verbose() > 1)
+		qDebug() << "VehicleSignals: emitting notification" << path << " = " << value;
+	emit signalNotification(path, value, timestamp);
 }
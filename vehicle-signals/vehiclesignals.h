@@ -18,9 +18,33 @@
 #define VEHICLESIGNALS_H
 
 #include <QObject>
-#include <QWebSocket>
+#include <QSharedPointer>
+#include <QVariant>
+#include <QStringList>
+#include <QVector>
+#include <QPointer>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <functional>
+
+class VisSession;
+
+// Default time to wait for a reply to a request before failing it
+#define VIS_REQUEST_TIMEOUT	5000
+
+// get() max age accepting any cached value of a subscribed signal
+#define VIS_CACHE_ANY_AGE	-1
 
 // Class to read/hold VIS server configuration
+//
+// Configuration read from an app's settings is loaded by a background
+// job started on first use, the accessors block until it is available
+// (VisSession waits for it without blocking).  Configs for the same app
+// share the loaded configuration, and credential files are cached
+// process-wide and only re-read once they have been modified.
+
+class VehicleSignalsConfigData;
 
 class VehicleSignalsConfig
 {
@@ -31,33 +55,113 @@ public:
 				      const QByteArray &clientCert,
 				      const QByteArray &caCert,
 				      const QString &authToken,
-				      bool verifyPeer = true);
+				      bool verifyPeer = true,
+				      bool threaded = false,
+				      const QString &transport = QString("websocket"),
+				      const QString &tlsServerName = QString());
         explicit VehicleSignalsConfig(const QString &appname);
         ~VehicleSignalsConfig() {};
 
-	QString hostname() { return m_hostname; };
-	unsigned port() { return m_port; };
-	QByteArray clientKey() { return m_clientKey; };
-	QByteArray clientCert() { return m_clientCert; };
-	QByteArray caCert() { return m_caCert; };
-	QString authToken() { return m_authToken; };
-	bool verifyPeer() { return m_verifyPeer; };
-	bool valid() { return m_valid; };
-	unsigned verbose() { return m_verbose; };
+	QString hostname();
+	unsigned port();
+	QByteArray clientKey();
+	QByteArray clientCert();
+	QByteArray caCert();
+	QString authToken();
+	bool verifyPeer();
+	// Name expected in the server certificate if not the hostname,
+	// only used by the gRPC transport.
+	QString tlsServerName();
+	// Run websocket I/O and message decoding in a worker thread
+	bool threaded();
+	// "websocket" (VIS v1 JSON), "websocket-plain" (the same without
+	// TLS, e.g. for VisMockServer) or "grpc" (KUKSA.val val.v1)
+	QString transport();
+	// File to record websocket traffic to for VisMockServer, if any
+	QString recordFile();
+	bool valid();
+	unsigned verbose();
 
 private:
-	QString m_hostname;
-	unsigned m_port;
-	QByteArray m_clientKey;
-	QByteArray m_clientCert;
-	QByteArray m_caCert;
-	QString m_authToken;
-	bool m_verifyPeer;
-	bool m_valid;
-	unsigned m_verbose;
+	friend class VisSession;
+
+	QSharedPointer<VehicleSignalsConfigData> d;
+
+	void startLoading();
+	void wait();
+	bool isLoaded();
+	// Runs callback in context's thread once loaded
+	void whenLoaded(QObject *context, std::function<void()> callback);
+	// Identifies the session to use without loading, see VehicleSignals
+	QString key();
+};
+
+// Completion state of a request, handed to request callbacks
+
+struct VehicleSignalsResponse
+{
+	unsigned int requestId = 0;
+	QString action;
+	bool success = false;
+	QString error;
+	QString path;
+	QVariant value;
+	QString timestamp;
+
+	// Time in ms from sending the request to its completion
+	qint64 latency = 0;
 };
 
+typedef std::function<void(const VehicleSignalsResponse &response)> VehicleSignalsCallback;
+
+// Connection recovery statistics, see VehicleSignals::connectionStats
+
+struct VehicleSignalsConnectionStats
+{
+	// Number of times the connection has been re-established
+	unsigned int reconnects = 0;
+
+	// Time in ms from losing the connection to being ready again
+	// (authorized and subscriptions sent), and to the first
+	// notification received after that.  -1 if not (yet) known for
+	// the most recent reconnect.
+	qint64 lastReconnectTime = -1;
+	qint64 lastFirstNotificationTime = -1;
+};
+
+// Per-subscription notification filtering, applied before handlers
+// and signalNotification see an update.
+
+struct VehicleSignalsSubscribeOptions
+{
+	// Minimum time in ms between notifications, the latest update
+	// within the interval is delivered at its end.
+	int minInterval = 0;
+
+	// Numeric updates that differ from the last delivered value by
+	// less than this are dropped.
+	double deadband = 0.0;
+
+	// Only deliver the latest update received within one event loop
+	// iteration.
+	bool latestOnly = false;
+};
+
+// Per-path notification handler, see VehicleSignals::addSignalHandler
+
+typedef std::function<void(const QVariant &value, const QString &timestamp)> VehicleSignalsHandler;
+
 // VIS signaling interface class
+//
+// Objects created with equivalent configurations share one connection
+// to the server (see VisSession), with subscriptions, notifications and
+// replies routed per object.  Each object only sees notifications for
+// paths it has subscribed to itself.
+//
+// Configurations read from settings are equivalent if they are for the
+// same app, i.e. sharing is per app.  Different apps in one process get
+// separate connections even if configured for the same server, as the
+// server is not known until the settings have been loaded.
 
 class VehicleSignals : public QObject
 {
@@ -70,30 +174,110 @@ public:
 	Q_INVOKABLE void connect();	
 	Q_INVOKABLE void authorize();
 
-	Q_INVOKABLE void get(const QString &path);
-	Q_INVOKABLE void set(const QString &path, const QString &value);
-	Q_INVOKABLE void subscribe(const QString &path);
+	// The request methods return the request id used on the wire, or
+	// 0 if nothing needed to be sent (e.g. a repeated subscribe).
+	// The callback variants are invoked exactly once, with either
+	// the reply matching that id or a timeout/disconnect error.
+	//
+	// A get of a path that is subscribed to is answered from the last
+	// value received if it is at most maxAge ms old (any age with
+	// VIS_CACHE_ANY_AGE), a maxAge of 0 always queries the server.
+	Q_INVOKABLE unsigned int get(const QString &path);
+	Q_INVOKABLE unsigned int get(const QString &path, int maxAge);
+	Q_INVOKABLE unsigned int set(const QString &path, const QVariant &value);
+	Q_INVOKABLE unsigned int subscribe(const QString &path);
+
+	unsigned int get(const QString &path,
+			 VehicleSignalsCallback callback,
+			 int timeout = VIS_REQUEST_TIMEOUT,
+			 int maxAge = VIS_CACHE_ANY_AGE);
+	unsigned int set(const QString &path,
+			 const QVariant &value,
+			 VehicleSignalsCallback callback,
+			 int timeout = VIS_REQUEST_TIMEOUT);
+	unsigned int subscribe(const QString &path,
+			       VehicleSignalsCallback callback,
+			       int timeout = VIS_REQUEST_TIMEOUT);
+	unsigned int subscribe(const QString &path,
+			       const VehicleSignalsSubscribeOptions &options,
+			       VehicleSignalsCallback callback = nullptr,
+			       int timeout = VIS_REQUEST_TIMEOUT);
+
+	// Batched requests are queued and written out together at the
+	// end of the current event loop iteration.  Repeated sets of a
+	// path within a batch collapse to the last value, and repeated
+	// gets/subscribes of a path are only sent once.
+	Q_INVOKABLE void getMany(const QStringList &paths);
+	Q_INVOKABLE void setMany(const QVariantMap &values);
+	Q_INVOKABLE void subscribeMany(const QStringList &paths);
+	void subscribeMany(const QStringList &paths, const VehicleSignalsSubscribeOptions &options);
+
+	// Paths are interned into small integer ids that stay valid for
+	// the lifetime of the object.  Handlers registered for a path are
+	// called directly for its notifications, and are dropped once
+	// their context object is destroyed.  Subscribing is still up to
+	// the caller.
+	int pathId(const QString &path);
+	int addSignalHandler(const QString &path, QObject *context, VehicleSignalsHandler handler);
+	void removeSignalHandlers(QObject *context);
+
+	// Returns the last value received for path on the current
+	// connection, with its age in ms if requested.
+	bool cachedValue(const QString &path, QVariant &value, QString &timestamp, qint64 *age = nullptr);
+
+	// The connection is re-established automatically with backoff,
+	// and authorization and subscriptions are replayed on it.
+	VehicleSignalsConnectionStats connectionStats();
 
 signals:
 	void connected();
 	void authorized();
-        void getSuccessResponse(QString path, QString value, QString timestamp);
-        void signalNotification(QString path, QString value, QString timestamp);
+	// Values are passed through with their JSON type, i.e. as a
+	// QString, double or bool.
+        void getSuccessResponse(QString path, QVariant value, QString timestamp);
+        void signalNotification(QString path, QVariant value, QString timestamp);
 	void disconnected();
 
 private slots:
-	void onConnected();
-	void onError(QAbstractSocket::SocketError error);
-	void reconnect();
-	void onDisconnected();
-	void onTextMessageReceived(QString message);
+	void onFilterTimeout();
 
 private:
-	VehicleSignalsConfig m_config;
-	QWebSocket m_websocket;
-	std::atomic<unsigned int> m_request_id;
+	friend class VisSession;
+
+	struct SignalHandler {
+		QPointer<QObject> context;
+		VehicleSignalsHandler handler;
+	};
+
+	QSharedPointer<VisSession> m_session;
+
+	// Filter state of a subscription with options, times are
+	// m_clock ms.
+	struct SignalFilter {
+		VehicleSignalsSubscribeOptions options;
+		QString path;
+		bool delivered = false;
+		QVariant lastValue;
+		qint64 lastTime = -1;
+		bool pending = false;
+		QVariant pendingValue;
+		QString pendingTimestamp;
+		qint64 due = 0;
+	};
+
+	// Handlers indexed by path id
+	QVector<QVector<SignalHandler>> m_handlers;
+
+	// Filters keyed by path id
+	QHash<int, SignalFilter> m_filters;
+	QElapsedTimer m_clock;
+	QTimer m_filter_timer;
+	qint64 m_filter_timer_due;
 
-	bool parseData(const QJsonObject &response, QString &path, QString &value, QString &timestamp);
+	void setSubscribeOptions(const QString &path, const VehicleSignalsSubscribeOptions &options);
+	void armFilterTimer(qint64 due);
+	void deliverNotification(int id, const QString &path, const QVariant &value, const QString &timestamp);
+	void dispatchNotification(int id, const QString &path, const QVariant &value, const QString &timestamp);
 };
 
 #endif // VEHICLESIGNALS_H
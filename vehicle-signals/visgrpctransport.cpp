@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QDateTime>
+#include <chrono>
+
+#include "visgrpctransport.h"
+
+using grpc::ClientContext;
+using grpc::ClientReader;
+using grpc::Status;
+using grpc::StatusCode;
+
+using kuksa::val::v1::VAL;
+using kuksa::val::v1::DataEntry;
+using kuksa::val::v1::Datapoint;
+using kuksa::val::v1::EntryRequest;
+using kuksa::val::v1::EntryUpdate;
+using kuksa::val::v1::GetRequest;
+using kuksa::val::v1::GetResponse;
+using kuksa::val::v1::SetRequest;
+using kuksa::val::v1::SetResponse;
+using kuksa::val::v1::SubscribeEntry;
+using kuksa::val::v1::SubscribeRequest;
+using kuksa::val::v1::SubscribeResponse;
+
+// Enum values used
+using kuksa::val::v1::DataType;
+using kuksa::val::v1::EntryType;
+using kuksa::val::v1::ENTRY_TYPE_UNSPECIFIED;
+using kuksa::val::v1::ENTRY_TYPE_ACTUATOR;
+using kuksa::val::v1::FIELD_VALUE;
+using kuksa::val::v1::FIELD_ACTUATOR_TARGET;
+using kuksa::val::v1::FIELD_METADATA_DATA_TYPE;
+using kuksa::val::v1::FIELD_METADATA_ENTRY_TYPE;
+using kuksa::val::v1::VIEW_CURRENT_VALUE;
+using kuksa::val::v1::VIEW_FIELDS;
+
+// Values are handed to clients the same way the JSON transport
+// decodes them, i.e. all numbers as doubles.
+static QVariant toVariant(const Datapoint &dp)
+{
+	switch (dp.value_case()) {
+	case Datapoint::kString:
+		return QString::fromStdString(dp.string());
+	case Datapoint::kBool:
+		return dp.bool_();
+	case Datapoint::kInt32:
+		return double(dp.int32());
+	case Datapoint::kInt64:
+		return double(dp.int64());
+	case Datapoint::kUint32:
+		return double(dp.uint32());
+	case Datapoint::kUint64:
+		return double(dp.uint64());
+	case Datapoint::kFloat:
+		return double(dp.float_());
+	case Datapoint::kDouble:
+		return dp.double_();
+	default:
+		// Arrays are not supported, as with the JSON transport
+		return QVariant();
+	}
+}
+
+static QString toTimestamp(const Datapoint &dp)
+{
+	QDateTime ts;
+	if (dp.has_timestamp()) {
+		const auto &t = dp.timestamp();
+		ts = QDateTime::fromMSecsSinceEpoch(t.seconds() * 1000 + t.nanos() / 1000000, Qt::UTC);
+	} else {
+		ts = QDateTime::currentDateTimeUtc();
+	}
+	return ts.toString(Qt::ISODateWithMs);
+}
+
+static bool fromVariant(const QVariant &value, int dataType, Datapoint *dp)
+{
+	switch (dataType) {
+	case kuksa::val::v1::DATA_TYPE_STRING:
+		dp->set_string(value.toString().toStdString());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_BOOLEAN:
+		dp->set_bool_(value.toBool());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_INT8:
+	case kuksa::val::v1::DATA_TYPE_INT16:
+	case kuksa::val::v1::DATA_TYPE_INT32:
+		dp->set_int32(value.toInt());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_INT64:
+		dp->set_int64(value.toLongLong());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_UINT8:
+	case kuksa::val::v1::DATA_TYPE_UINT16:
+	case kuksa::val::v1::DATA_TYPE_UINT32:
+		dp->set_uint32(value.toUInt());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_UINT64:
+		dp->set_uint64(value.toULongLong());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_FLOAT:
+		dp->set_float_(value.toFloat());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_DOUBLE:
+		dp->set_double_(value.toDouble());
+		return true;
+	case kuksa::val::v1::DATA_TYPE_UNSPECIFIED:
+		break;
+	default:
+		// Arrays and timestamps
+		return false;
+	}
+
+	// Type unknown, go by the value
+	switch (value.userType()) {
+	case QMetaType::Bool:
+		dp->set_bool_(value.toBool());
+		break;
+	case QMetaType::Int:
+	case QMetaType::Short:
+		dp->set_int32(value.toInt());
+		break;
+	case QMetaType::UInt:
+	case QMetaType::UShort:
+		dp->set_uint32(value.toUInt());
+		break;
+	case QMetaType::Long:
+	case QMetaType::LongLong:
+		dp->set_int64(value.toLongLong());
+		break;
+	case QMetaType::ULong:
+	case QMetaType::ULongLong:
+		dp->set_uint64(value.toULongLong());
+		break;
+	case QMetaType::Float:
+		dp->set_float_(value.toFloat());
+		break;
+	case QMetaType::Double:
+		dp->set_double_(value.toDouble());
+		break;
+	default:
+		dp->set_string(value.toString().toStdString());
+		break;
+	}
+	return true;
+}
+
+static void fillData(const DataEntry &entry, VisMessage &message)
+{
+	message.hasData = true;
+	message.hasPath = true;
+	message.path = QString::fromStdString(entry.path());
+	if (entry.has_value()) {
+		message.hasDatapoint = true;
+		message.hasValue = true;
+		message.value = toVariant(entry.value());
+		message.hasTimestamp = true;
+		message.timestamp = toTimestamp(entry.value());
+	}
+}
+
+VisGrpcSubscription::VisGrpcSubscription(int id,
+					 std::shared_ptr<VAL::Stub> stub,
+					 const QString &authToken,
+					 const QStringList &paths,
+					 QObject *parent) :
+	QObject(parent),
+	m_id(id),
+	m_stub(stub),
+	m_token(authToken),
+	m_paths(paths),
+	m_cancelled(false)
+{
+	if (!m_token.isEmpty())
+		m_context.AddMetadata("authorization", ("Bearer " + m_token).toStdString());
+}
+
+void VisGrpcSubscription::cancel()
+{
+	m_cancelled = true;
+	m_context.TryCancel();
+}
+
+void VisGrpcSubscription::run()
+{
+	SubscribeRequest request;
+	for (const auto &path : m_paths) {
+		SubscribeEntry *entry = request.add_entries();
+		entry->set_path(path.toStdString());
+		entry->set_view(VIEW_CURRENT_VALUE);
+		entry->add_fields(FIELD_VALUE);
+	}
+
+	SubscribeResponse response;
+	bool first = true;
+	std::unique_ptr<ClientReader<SubscribeResponse> > reader(m_stub->Subscribe(&m_context, request));
+	while (reader->Read(&response)) {
+		// The server answers with the current values first
+		if (first) {
+			emit started(m_id);
+			first = false;
+		}
+
+		QVector<VisMessage> messages;
+		messages.reserve(response.updates_size());
+		for (const auto &update : response.updates()) {
+			VisMessage message;
+			message.action = QStringLiteral("subscription");
+			fillData(update.entry(), message);
+			messages.append(message);
+		}
+		emit updates(m_id, messages);
+	}
+
+	Status status = reader->Finish();
+	QString error;
+	if (!m_cancelled) {
+		error = status.ok() ? QStringLiteral("subscription ended") :
+			QString::fromStdString(status.error_message());
+		qWarning() << "KUKSA.val Subscribe stream failed:" << error;
+	}
+	emit finished(m_id, error);
+}
+
+VisGrpcTransport::VisGrpcTransport(const VehicleSignalsConfig &config, QObject *parent) :
+	VisTransport(config, parent),
+	m_connected(false),
+	// Parented so that it follows the transport to a worker thread
+	m_subscribe_timer(this),
+	m_next_subscription(0)
+{
+	// Subscribes are gathered into one stream per event loop iteration
+	m_subscribe_timer.setSingleShot(true);
+	m_subscribe_timer.setInterval(0);
+	QObject::connect(&m_subscribe_timer, &QTimer::timeout, this, &VisGrpcTransport::startSubscriptions);
+}
+
+VisGrpcTransport::~VisGrpcTransport()
+{
+	QList<int> ids = m_subscriptions.keys();
+	for (int id : ids)
+		stopSubscription(id);
+}
+
+void VisGrpcTransport::open()
+{
+	grpc::SslCredentialsOptions options;
+	options.pem_root_certs = m_config.caCert().toStdString();
+	options.pem_private_key = m_config.clientKey().toStdString();
+	options.pem_cert_chain = m_config.clientCert().toStdString();
+
+	// NOTE: gRPC always verifies the server certificate, including
+	//       its name.  Servers using a certificate issued for another
+	//       name (e.g. "Server" in the example KUKSA.val ones) need
+	//       that name configured.
+	grpc::ChannelArguments args;
+	QString serverName = m_config.tlsServerName();
+	if (!serverName.isEmpty())
+		args.SetSslTargetNameOverride(serverName.toStdString());
+
+	QString target = QString("%1:%2").arg(m_config.hostname()).arg(m_config.port());
+	if (m_config.verbose())
+		qInfo() << "Opening KUKSA.val gRPC channel to" << target;
+	m_channel = grpc::CreateCustomChannel(target.toStdString(), grpc::SslCredentials(options), args);
+	m_stub = VAL::NewStub(m_channel);
+
+	auto deadline = std::chrono::system_clock::now() + std::chrono::milliseconds(VIS_REQUEST_TIMEOUT);
+	if (!m_channel->WaitForConnected(deadline)) {
+		m_stub.reset();
+		m_channel.reset();
+		emit errorOccurred(QStringLiteral("could not connect to KUKSA.val server"), true);
+		return;
+	}
+
+	m_connected = true;
+	emit connected();
+}
+
+void VisGrpcTransport::close()
+{
+	connectionLost();
+}
+
+void VisGrpcTransport::connectionLost()
+{
+	m_subscribe_timer.stop();
+	m_pending_subscribes.clear();
+	QList<int> ids = m_subscriptions.keys();
+	for (int id : ids)
+		stopSubscription(id);
+
+	m_stub.reset();
+	m_channel.reset();
+	if (!m_connected)
+		return;
+
+	m_connected = false;
+	flushMessages();
+	emit disconnected();
+}
+
+void VisGrpcTransport::addAuthorization(ClientContext &context)
+{
+	QString token = m_config.authToken();
+	if (!token.isEmpty())
+		context.AddMetadata("authorization", ("Bearer " + token).toStdString());
+
+	auto deadline = std::chrono::system_clock::now() + std::chrono::milliseconds(VIS_REQUEST_TIMEOUT);
+	context.set_deadline(deadline);
+}
+
+bool VisGrpcTransport::checkStatus(const Status &status, QString &error)
+{
+	if (status.ok())
+		return true;
+
+	error = QString::fromStdString(status.error_message());
+	if (status.error_code() == StatusCode::UNAVAILABLE)
+		connectionLost();
+	return false;
+}
+
+void VisGrpcTransport::reply(const QString &action, unsigned int requestId, const QString &error)
+{
+	VisMessage message;
+	message.action = action;
+	message.hasRequestId = true;
+	message.requestId = requestId;
+	if (!error.isEmpty()) {
+		message.hasError = true;
+		message.error = error;
+	}
+	receiveMessage(message);
+}
+
+void VisGrpcTransport::sendRequest(const QString &action,
+				   unsigned int requestId,
+				   const QString &path,
+				   const QVariant &value)
+{
+	if (!m_connected) {
+		// Dropped as a websocket would, the request times out
+		return;
+	}
+
+	if (action == "authorize") {
+		// The token is sent along with every call instead
+		reply(action, requestId, QString());
+	} else if (action == "get") {
+		get(requestId, path);
+	} else if (action == "set") {
+		set(requestId, path, value);
+	} else if (action == "subscribe") {
+		m_pending_subscribes.append(qMakePair(requestId, path));
+		if (!m_subscribe_timer.isActive())
+			m_subscribe_timer.start();
+	} else {
+		reply(action, requestId, QStringLiteral("unsupported request"));
+	}
+}
+
+void VisGrpcTransport::get(unsigned int requestId, const QString &path)
+{
+	GetRequest request;
+	EntryRequest *entry = request.add_entries();
+	entry->set_path(path.toStdString());
+	entry->set_view(VIEW_CURRENT_VALUE);
+	entry->add_fields(FIELD_VALUE);
+
+	ClientContext context;
+	addAuthorization(context);
+	GetResponse response;
+	QString error;
+	Status status = m_stub->Get(&context, request, &response);
+	if (!checkStatus(status, error)) {
+		reply(QStringLiteral("get"), requestId, error);
+		return;
+	}
+	if (response.errors_size() > 0) {
+		reply(QStringLiteral("get"), requestId, QString::fromStdString(response.errors(0).error().message()));
+		return;
+	}
+	if (response.entries_size() == 0) {
+		reply(QStringLiteral("get"), requestId, QStringLiteral("no value"));
+		return;
+	}
+
+	VisMessage message;
+	message.action = QStringLiteral("get");
+	message.hasRequestId = true;
+	message.requestId = requestId;
+	fillData(response.entries(0), message);
+	receiveMessage(message);
+}
+
+bool VisGrpcTransport::lookupMetadata(const QString &path, EntryInfo &info)
+{
+	auto it = m_entries.constFind(path);
+	if (it != m_entries.cend()) {
+		info = it.value();
+		return true;
+	}
+
+	GetRequest request;
+	EntryRequest *entry = request.add_entries();
+	entry->set_path(path.toStdString());
+	entry->set_view(VIEW_FIELDS);
+	entry->add_fields(FIELD_METADATA_DATA_TYPE);
+	entry->add_fields(FIELD_METADATA_ENTRY_TYPE);
+
+	ClientContext context;
+	addAuthorization(context);
+	GetResponse response;
+	QString error;
+	Status status = m_stub->Get(&context, request, &response);
+	if (!checkStatus(status, error) || response.entries_size() == 0)
+		return false;
+
+	const auto &metadata = response.entries(0).metadata();
+	info.dataType = metadata.data_type();
+	info.entryType = metadata.entry_type();
+	m_entries.insert(path, info);
+	return true;
+}
+
+void VisGrpcTransport::set(unsigned int requestId, const QString &path, const QVariant &value)
+{
+	// The broker is strict about types, so values are converted to
+	// the type of the signal.  Setting an actuator sets its target,
+	// which is what the actuator's provider acts on.
+	EntryInfo info = { kuksa::val::v1::DATA_TYPE_UNSPECIFIED, ENTRY_TYPE_UNSPECIFIED };
+	lookupMetadata(path, info);
+	if (!m_connected)
+		return;
+
+	SetRequest request;
+	EntryUpdate *update = request.add_updates();
+	DataEntry *entry = update->mutable_entry();
+	entry->set_path(path.toStdString());
+	bool valid;
+	if (info.entryType == ENTRY_TYPE_ACTUATOR) {
+		valid = fromVariant(value, info.dataType, entry->mutable_actuator_target());
+		update->add_fields(FIELD_ACTUATOR_TARGET);
+	} else {
+		valid = fromVariant(value, info.dataType, entry->mutable_value());
+		update->add_fields(FIELD_VALUE);
+	}
+	if (!valid) {
+		reply(QStringLiteral("set"), requestId, QStringLiteral("unsupported value type"));
+		return;
+	}
+
+	ClientContext context;
+	addAuthorization(context);
+	SetResponse response;
+	QString error;
+	Status status = m_stub->Set(&context, request, &response);
+	if (!checkStatus(status, error)) {
+		reply(QStringLiteral("set"), requestId, error);
+		return;
+	}
+	if (response.has_error() && response.error().code() != 0 && response.error().code() != 200)
+		error = QString::fromStdString(response.error().message());
+	else if (response.errors_size() > 0)
+		error = QString::fromStdString(response.errors(0).error().message());
+	reply(QStringLiteral("set"), requestId, error);
+}
+
+void VisGrpcTransport::startSubscriptions()
+{
+	if (m_pending_subscribes.isEmpty() || !m_connected)
+		return;
+
+	QList<unsigned int> requestIds;
+	QStringList paths;
+	for (const auto &pending : m_pending_subscribes) {
+		requestIds.append(pending.first);
+		paths.append(pending.second);
+	}
+	m_pending_subscribes.clear();
+	startSubscription(requestIds, paths);
+}
+
+void VisGrpcTransport::startSubscription(const QList<unsigned int> &requestIds, const QStringList &paths)
+{
+	Subscription subscription;
+	subscription.requestIds = requestIds;
+	subscription.paths = paths;
+
+	int id = m_next_subscription++;
+	subscription.thread = new QThread();
+	subscription.reader = new VisGrpcSubscription(id, m_stub, m_config.authToken(), paths);
+	subscription.reader->moveToThread(subscription.thread);
+	QObject::connect(subscription.thread, &QThread::started,
+			 subscription.reader, &VisGrpcSubscription::run);
+	QObject::connect(subscription.reader, &VisGrpcSubscription::finished,
+			 subscription.thread, &QThread::quit);
+	QObject::connect(subscription.reader, &VisGrpcSubscription::started,
+			 this, &VisGrpcTransport::onSubscriptionStarted);
+	QObject::connect(subscription.reader, &VisGrpcSubscription::updates,
+			 this, &VisGrpcTransport::onSubscriptionUpdates);
+	QObject::connect(subscription.reader, &VisGrpcSubscription::finished,
+			 this, &VisGrpcTransport::onSubscriptionFinished);
+	m_subscriptions.insert(id, subscription);
+
+	if (m_config.verbose() > 1)
+		qDebug() << "VisGrpcTransport: subscribing to" << paths;
+	subscription.thread->start();
+}
+
+void VisGrpcTransport::onSubscriptionStarted(int id)
+{
+	auto it = m_subscriptions.find(id);
+	if (it == m_subscriptions.end())
+		return;
+
+	QList<unsigned int> requestIds;
+	requestIds.swap(it->requestIds);
+	for (auto requestId : requestIds)
+		reply(QStringLiteral("subscribe"), requestId, QString());
+}
+
+void VisGrpcTransport::onSubscriptionUpdates(int id, QVector<VisMessage> messages)
+{
+	// Updates from a stream already stopped are dropped
+	if (!m_subscriptions.contains(id))
+		return;
+
+	for (const auto &message : messages)
+		receiveMessage(message);
+}
+
+void VisGrpcTransport::onSubscriptionFinished(int id, QString error)
+{
+	auto it = m_subscriptions.find(id);
+	if (it == m_subscriptions.end())
+		return;
+
+	QList<unsigned int> requestIds = it->requestIds;
+	QStringList paths = it->paths;
+	stopSubscription(id);
+
+	if (requestIds.size() > 1 && !error.isEmpty() && m_connected) {
+		// One unknown or unauthorized path fails the whole stream,
+		// retry each on its own so that only that one fails.
+		for (int i = 0; i < requestIds.size(); i++)
+			startSubscription({ requestIds[i] }, { paths[i] });
+	} else if (!requestIds.isEmpty()) {
+		// Rejected before it started, e.g. an unknown path
+		for (auto requestId : requestIds)
+			reply(QStringLiteral("subscribe"), requestId, error);
+	} else if (!error.isEmpty()) {
+		// Streams end when the server goes away
+		connectionLost();
+	}
+}
+
+void VisGrpcTransport::stopSubscription(int id)
+{
+	Subscription subscription = m_subscriptions.take(id);
+	if (!subscription.thread)
+		return;
+
+	subscription.reader->cancel();
+	subscription.thread->quit();
+	subscription.thread->wait();
+	delete subscription.reader;
+	delete subscription.thread;
+}
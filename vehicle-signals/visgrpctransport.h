@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_GRPC_TRANSPORT_H
+#define VIS_GRPC_TRANSPORT_H
+
+#include <QHash>
+#include <QStringList>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <grpcpp/grpcpp.h>
+
+#include "vistransport.h"
+#include "kuksa/val/v1/val.grpc.pb.h"
+
+// Reads one KUKSA.val Subscribe stream in its own thread, as the
+// synchronous gRPC API blocks while waiting for updates.
+
+class VisGrpcSubscription : public QObject
+{
+	Q_OBJECT
+
+public:
+	VisGrpcSubscription(int id,
+			    std::shared_ptr<kuksa::val::v1::VAL::Stub> stub,
+			    const QString &authToken,
+			    const QStringList &paths,
+			    QObject *parent = Q_NULLPTR);
+
+	// May be called from any thread
+	void cancel();
+
+public slots:
+	void run();
+
+signals:
+	// The server has accepted the subscription
+	void started(int id);
+	void updates(int id, QVector<VisMessage> messages);
+	// error is empty if cancelled
+	void finished(int id, QString error);
+
+private:
+	int m_id;
+	std::shared_ptr<kuksa::val::v1::VAL::Stub> m_stub;
+	QString m_token;
+	QStringList m_paths;
+	grpc::ClientContext m_context;
+	std::atomic<bool> m_cancelled;
+};
+
+// KUKSA.val val.v1 over gRPC, as spoken by kuksa-databroker.  The
+// session's VIS requests are mapped onto the Get, Set and Subscribe
+// RPCs, and replies are handed back as the equivalent VIS messages.
+//
+// NOTE: Connecting, Get and Set are synchronous calls, so VisSession
+//       always runs this transport in a worker thread.
+
+class VisGrpcTransport : public VisTransport
+{
+	Q_OBJECT
+
+public:
+	explicit VisGrpcTransport(const VehicleSignalsConfig &config, QObject *parent = Q_NULLPTR);
+	virtual ~VisGrpcTransport();
+
+	void open() override;
+	void close() override;
+	void sendRequest(const QString &action,
+			 unsigned int requestId,
+			 const QString &path,
+			 const QVariant &value) override;
+
+private slots:
+	void startSubscriptions();
+	void onSubscriptionStarted(int id);
+	void onSubscriptionUpdates(int id, QVector<VisMessage> messages);
+	void onSubscriptionFinished(int id, QString error);
+
+private:
+	// Subscribe stream, requestIds are the subscribe requests waiting
+	// for the stream to be accepted, for paths.
+	struct Subscription {
+		QThread *thread = nullptr;
+		VisGrpcSubscription *reader = nullptr;
+		QList<unsigned int> requestIds;
+		QStringList paths;
+	};
+
+	// Data and entry type of a path, see lookupMetadata
+	struct EntryInfo {
+		int dataType;
+		int entryType;
+	};
+
+	std::shared_ptr<grpc::Channel> m_channel;
+	std::shared_ptr<kuksa::val::v1::VAL::Stub> m_stub;
+	bool m_connected;
+
+	QHash<QString, EntryInfo> m_entries;
+
+	QList<QPair<unsigned int, QString>> m_pending_subscribes;
+	QTimer m_subscribe_timer;
+	QHash<int, Subscription> m_subscriptions;
+	int m_next_subscription;
+
+	void addAuthorization(grpc::ClientContext &context);
+	bool checkStatus(const grpc::Status &status, QString &error);
+	void reply(const QString &action, unsigned int requestId, const QString &error);
+	void get(unsigned int requestId, const QString &path);
+	void set(unsigned int requestId, const QString &path, const QVariant &value);
+	bool lookupMetadata(const QString &path, EntryInfo &info);
+	void startSubscription(const QList<unsigned int> &requestIds, const QStringList &paths);
+	void stopSubscription(int id);
+	void connectionLost();
+};
+
+#endif // VIS_GRPC_TRANSPORT_H
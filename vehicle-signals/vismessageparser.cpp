@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QString>
+
+#include "vismessageparser.h"
+
+// Guard against runaway recursion on hostile input, real messages
+// nest at most a few levels deep.
+#define MAX_DEPTH 32
+
+bool VisMessageParser::parse(const QString &message, VisMessage &result)
+{
+	m_message = &message;
+	m_data = message.constData();
+	m_pos = 0;
+	m_size = message.size();
+
+	result = VisMessage();
+
+	skipWhitespace();
+	if (!parseObject(TopLevel, result, 0))
+		return false;
+
+	skipWhitespace();
+	return m_pos == m_size;
+}
+
+bool VisMessageParser::parseObject(Context context, VisMessage &result, int depth)
+{
+	if (depth > MAX_DEPTH || !expect('{'))
+		return false;
+
+	skipWhitespace();
+	if (expect('}'))
+		return true;
+
+	while (true) {
+		skipWhitespace();
+		Token key;
+		if (!scanString(key))
+			return false;
+
+		skipWhitespace();
+		if (!expect(':'))
+			return false;
+		skipWhitespace();
+
+		if (!parseMember(context, key, result, depth))
+			return false;
+
+		skipWhitespace();
+		if (expect('}'))
+			return true;
+		if (!expect(','))
+			return false;
+	}
+}
+
+bool VisMessageParser::parseMember(Context context, const Token &key, VisMessage &result, int depth)
+{
+	switch (context) {
+	case TopLevel:
+		if (keyIs(key, "action"))
+			return parseStringValue(result.action);
+
+		if (keyIs(key, "requestId")) {
+			QString id;
+			if (!parseIdValue(id))
+				return false;
+			result.requestId = id.toUInt(&result.hasRequestId);
+			return true;
+		}
+
+		if (keyIs(key, "subscriptionId"))
+			return parseIdValue(result.subscriptionId);
+
+		if (keyIs(key, "error")) {
+			// KUKSA.val reports errors as an object with number,
+			// reason and message members, but accept a plain
+			// string as well.
+			result.hasError = true;
+			if (peek('"'))
+				return parseStringValue(result.error);
+			if (peek('{')) {
+				m_errorMessage.clear();
+				m_errorReason.clear();
+				if (!parseObject(Error, result, depth + 1))
+					return false;
+				result.error = m_errorMessage.isEmpty() ? m_errorReason : m_errorMessage;
+				return true;
+			}
+			return skipValue(depth + 1);
+		}
+
+		if (keyIs(key, "data") && peek('{')) {
+			result.hasData = true;
+			return parseObject(Data, result, depth + 1);
+		}
+		break;
+
+	case Data:
+		if (keyIs(key, "path")) {
+			if (!peek('"'))
+				break;
+			result.hasPath = true;
+			return parseStringValue(result.path);
+		}
+
+		if (keyIs(key, "dp") && peek('{')) {
+			result.hasDatapoint = true;
+			return parseObject(Datapoint, result, depth + 1);
+		}
+		break;
+
+	case Datapoint:
+		if (keyIs(key, "value")) {
+			// Objects/arrays/null are not supported values, flag
+			// them by leaving value invalid.
+			result.hasValue = true;
+			if (peek('{') || peek('[') || peek('n'))
+				return skipValue(depth + 1);
+			return parseScalar(result.value);
+		}
+
+		if (keyIs(key, "ts")) {
+			if (!peek('"'))
+				break;
+			result.hasTimestamp = true;
+			return parseStringValue(result.timestamp);
+		}
+		break;
+
+	case Error:
+		if (keyIs(key, "message") && peek('"'))
+			return parseStringValue(m_errorMessage);
+		if (keyIs(key, "reason") && peek('"'))
+			return parseStringValue(m_errorReason);
+		break;
+
+	default:
+		break;
+	}
+
+	return skipValue(depth + 1);
+}
+
+bool VisMessageParser::skipValue(int depth)
+{
+	if (depth > MAX_DEPTH || m_pos >= m_size)
+		return false;
+
+	Token token;
+	switch (m_data[m_pos].unicode()) {
+	case '{': {
+		VisMessage unused;
+		return parseObject(Other, unused, depth);
+	}
+	case '[':
+		return skipArray(depth);
+	case '"':
+		return scanString(token);
+	default: {
+		QVariant unused;
+		if (peek('n')) {
+			// null
+			if (m_size - m_pos >= 4 && keyIs(Token{m_pos, 4, false}, "null")) {
+				m_pos += 4;
+				return true;
+			}
+			return false;
+		}
+		return parseScalar(unused);
+	}
+	}
+}
+
+bool VisMessageParser::skipArray(int depth)
+{
+	if (!expect('['))
+		return false;
+
+	skipWhitespace();
+	if (expect(']'))
+		return true;
+
+	while (true) {
+		skipWhitespace();
+		if (!skipValue(depth + 1))
+			return false;
+		skipWhitespace();
+		if (expect(']'))
+			return true;
+		if (!expect(','))
+			return false;
+	}
+}
+
+bool VisMessageParser::scanString(Token &token)
+{
+	if (!expect('"'))
+		return false;
+
+	token.start = m_pos;
+	token.escaped = false;
+	while (m_pos < m_size) {
+		ushort c = m_data[m_pos].unicode();
+		if (c == '"') {
+			token.length = m_pos - token.start;
+			m_pos++;
+			return true;
+		}
+		if (c == '\\') {
+			token.escaped = true;
+			m_pos++;
+		}
+		m_pos++;
+	}
+	return false;
+}
+
+bool VisMessageParser::scanNumber(Token &token)
+{
+	token.start = m_pos;
+	token.escaped = false;
+	while (m_pos < m_size) {
+		ushort c = m_data[m_pos].unicode();
+		if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+			break;
+		m_pos++;
+	}
+	token.length = m_pos - token.start;
+	return token.length > 0;
+}
+
+bool VisMessageParser::parseScalar(QVariant &value)
+{
+	if (m_pos >= m_size)
+		return false;
+
+	Token token;
+	ushort c = m_data[m_pos].unicode();
+	if (c == '"') {
+		if (!scanString(token))
+			return false;
+		value = tokenString(token);
+		return true;
+	}
+
+	if (c == 't' && m_size - m_pos >= 4 && keyIs(Token{m_pos, 4, false}, "true")) {
+		m_pos += 4;
+		value = true;
+		return true;
+	}
+	if (c == 'f' && m_size - m_pos >= 5 && keyIs(Token{m_pos, 5, false}, "false")) {
+		m_pos += 5;
+		value = false;
+		return true;
+	}
+
+	if (!scanNumber(token))
+		return false;
+
+	// QStringRef::toDouble always uses the C locale
+	bool ok = false;
+	double d = QStringRef(m_message, token.start, token.length).toDouble(&ok);
+	if (!ok)
+		return false;
+	value = d;
+	return true;
+}
+
+bool VisMessageParser::parseStringValue(QString &value)
+{
+	Token token;
+	if (!scanString(token))
+		return false;
+	value = tokenString(token);
+	return true;
+}
+
+bool VisMessageParser::parseIdValue(QString &value)
+{
+	// Ids are strings, but tolerate them being sent as numbers
+	Token token;
+	if (peek('"')) {
+		if (!scanString(token))
+			return false;
+	} else if (!scanNumber(token)) {
+		return false;
+	}
+	value = tokenString(token);
+	return true;
+}
+
+QString VisMessageParser::tokenString(const Token &token) const
+{
+	if (!token.escaped)
+		return QString(m_data + token.start, token.length);
+
+	QString str;
+	str.reserve(token.length);
+	int end = token.start + token.length;
+	for (int i = token.start; i < end; i++) {
+		QChar c = m_data[i];
+		if (c != QLatin1Char('\\') || i + 1 >= end) {
+			str.append(c);
+			continue;
+		}
+
+		c = m_data[++i];
+		switch (c.unicode()) {
+		case 'b': str.append(QLatin1Char('\b')); break;
+		case 'f': str.append(QLatin1Char('\f')); break;
+		case 'n': str.append(QLatin1Char('\n')); break;
+		case 'r': str.append(QLatin1Char('\r')); break;
+		case 't': str.append(QLatin1Char('\t')); break;
+		case 'u': {
+			if (i + 4 >= end) {
+				str.append(QChar(QChar::ReplacementCharacter));
+				i = end;
+				break;
+			}
+			bool ok = false;
+			ushort u = QStringRef(m_message, i + 1, 4).toUShort(&ok, 16);
+			str.append(ok ? QChar(u) : QChar(QChar::ReplacementCharacter));
+			i += 4;
+			break;
+		}
+		default:
+			// \" \\ \/
+			str.append(c);
+			break;
+		}
+	}
+	return str;
+}
+
+bool VisMessageParser::keyIs(const Token &key, const char *name) const
+{
+	const QChar *p = m_data + key.start;
+	int i = 0;
+	for (; i < key.length; i++) {
+		if (!name[i] || p[i].unicode() != uchar(name[i]))
+			return false;
+	}
+	return name[i] == '\0';
+}
+
+void VisMessageParser::skipWhitespace()
+{
+	while (m_pos < m_size) {
+		ushort c = m_data[m_pos].unicode();
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			break;
+		m_pos++;
+	}
+}
+
+bool VisMessageParser::expect(char c)
+{
+	if (m_pos < m_size && m_data[m_pos].unicode() == ushort(c)) {
+		m_pos++;
+		return true;
+	}
+	return false;
+}
+
+bool VisMessageParser::peek(char c)
+{
+	return m_pos < m_size && m_data[m_pos].unicode() == ushort(c);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_MESSAGE_PARSER_H
+#define VIS_MESSAGE_PARSER_H
+
+#include <QString>
+#include <QVariant>
+#include <QMetaType>
+
+// Fields of interest from an inbound VIS message
+
+struct VisMessage
+{
+	QString action;
+
+	bool hasRequestId = false;
+	unsigned int requestId = 0;
+
+	QString subscriptionId;
+
+	bool hasError = false;
+	QString error;
+
+	// data.path
+	bool hasData = false;
+	bool hasPath = false;
+	QString path;
+
+	// data.dp.value and data.dp.ts
+	bool hasDatapoint = false;
+	bool hasValue = false;
+	QVariant value;
+	bool hasTimestamp = false;
+	QString timestamp;
+};
+
+Q_DECLARE_METATYPE(VisMessage)
+
+// Single pass parser that picks the above fields out of a VIS message
+// without building a QJsonDocument.  Everything else is skipped over
+// without being copied.
+
+class VisMessageParser
+{
+public:
+	bool parse(const QString &message, VisMessage &result);
+
+private:
+	enum Context {
+		TopLevel,
+		Data,
+		Datapoint,
+		Error,
+		Other
+	};
+
+	// A string token, start/length exclude the quotes
+	struct Token {
+		int start;
+		int length;
+		bool escaped;
+	};
+
+	bool parseObject(Context context, VisMessage &result, int depth);
+	bool parseMember(Context context, const Token &key, VisMessage &result, int depth);
+	bool skipValue(int depth);
+	bool skipArray(int depth);
+	bool scanString(Token &token);
+	bool scanNumber(Token &token);
+	bool parseScalar(QVariant &value);
+	bool parseStringValue(QString &value);
+	bool parseIdValue(QString &value);
+	QString tokenString(const Token &token) const;
+	bool keyIs(const Token &key, const char *name) const;
+	void skipWhitespace();
+	bool expect(char c);
+	bool peek(char c);
+
+	const QString *m_message = nullptr;
+	const QChar *m_data = nullptr;
+	int m_pos = 0;
+	int m_size = 0;
+
+	// Scratch for the error object members
+	QString m_errorMessage;
+	QString m_errorReason;
+};
+
+#endif // VIS_MESSAGE_PARSER_H
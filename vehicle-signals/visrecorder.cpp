@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+
+#include "visrecorder.h"
+
+VisRecorder::~VisRecorder()
+{
+	flush();
+}
+
+bool VisRecorder::open(const QString &fileName)
+{
+	m_file.setFileName(fileName);
+	if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qWarning() << "Could not open VIS recording file" << fileName << ":" << m_file.errorString();
+		return false;
+	}
+
+	m_file.write(VIS_RECORDING_HEADER "\n");
+	m_clock.start();
+	return true;
+}
+
+void VisRecorder::record(bool outbound, const QByteArray &frame)
+{
+	if (!m_file.isOpen())
+		return;
+
+	QByteArray line;
+	line.reserve(frame.size() + 16);
+	line.append(QByteArray::number(m_clock.elapsed()));
+	line.append(outbound ? " > " : " < ");
+	line.append(frame);
+	// Newlines can only be whitespace in a JSON frame
+	line.replace('\n', ' ');
+	line.append('\n');
+	m_file.write(line);
+}
+
+void VisRecorder::flush()
+{
+	if (m_file.isOpen())
+		m_file.flush();
+}
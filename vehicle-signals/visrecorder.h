@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_RECORDER_H
+#define VIS_RECORDER_H
+
+#include <QFile>
+#include <QElapsedTimer>
+
+// Records VIS frames to a file for replaying with VisMockServer.  Each
+// frame is written on its own line as
+//
+// <ms since recording started> <'>' sent | '<' received> <frame>
+//
+// Lines starting with '#' are comments.
+
+#define VIS_RECORDING_HEADER	"# VIS recording 1"
+
+class VisRecorder
+{
+public:
+	~VisRecorder();
+
+	bool open(const QString &fileName);
+	void record(bool outbound, const QByteArray &frame);
+	void flush();
+
+private:
+	QFile m_file;
+	QElapsedTimer m_clock;
+};
+
+#endif // VIS_RECORDER_H
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+
+#include "visrequestwriter.h"
+
+// Typical requests are well under this, reserving also keeps Qt from
+// releasing the buffer when it is truncated for reuse.
+#define INITIAL_BUFFER_SIZE 512
+
+#define VIS_REDACTED_TOKEN "REDACTED"
+
+VisRequestWriter::VisRequestWriter()
+{
+	m_buffer.reserve(INITIAL_BUFFER_SIZE);
+}
+
+void VisRequestWriter::setToken(const QString &token)
+{
+	m_token.clear();
+	appendString(m_token, token);
+}
+
+const QByteArray &VisRequestWriter::write(const QString &action,
+					  unsigned int requestId,
+					  const QString &path,
+					  const QVariant &value,
+					  bool redactToken)
+{
+	m_buffer.resize(0);
+
+	m_buffer.append("{\"action\":");
+	appendString(action);
+	m_buffer.append(",\"tokens\":");
+	if (redactToken)
+		m_buffer.append("\"" VIS_REDACTED_TOKEN "\"");
+	else
+		m_buffer.append(m_token);
+	if (!path.isEmpty()) {
+		m_buffer.append(",\"path\":");
+		appendString(path);
+	}
+	if (value.isValid()) {
+		m_buffer.append(",\"value\":");
+		appendValue(value);
+	}
+	// KUKSA.val expects the request id as a string
+	m_buffer.append(",\"requestId\":\"");
+	appendNumber(requestId);
+	m_buffer.append("\"}");
+
+	return m_buffer;
+}
+
+void VisRequestWriter::appendString(const QString &str)
+{
+	appendString(m_buffer, str);
+}
+
+void VisRequestWriter::appendString(QByteArray &out, const QString &str)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	out.append('"');
+	const QChar *p = str.constData();
+	const QChar *end = p + str.size();
+	for (; p != end; ++p) {
+		ushort c = p->unicode();
+		if (c < 0x80) {
+			if (c == '"' || c == '\\') {
+				out.append('\\');
+				out.append(char(c));
+			} else if (c < 0x20) {
+				char esc[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+				out.append(esc, sizeof(esc));
+			} else {
+				out.append(char(c));
+			}
+		} else if (c < 0x800) {
+			out.append(char(0xc0 | (c >> 6)));
+			out.append(char(0x80 | (c & 0x3f)));
+		} else if (p->isHighSurrogate() && p + 1 != end && (p + 1)->isLowSurrogate()) {
+			uint ucs4 = QChar::surrogateToUcs4(*p, *(p + 1));
+			++p;
+			out.append(char(0xf0 | (ucs4 >> 18)));
+			out.append(char(0x80 | ((ucs4 >> 12) & 0x3f)));
+			out.append(char(0x80 | ((ucs4 >> 6) & 0x3f)));
+			out.append(char(0x80 | (ucs4 & 0x3f)));
+		} else if (p->isSurrogate()) {
+			// Unpaired surrogate, emit the replacement character
+			out.append("\xef\xbf\xbd");
+		} else {
+			out.append(char(0xe0 | (c >> 12)));
+			out.append(char(0x80 | ((c >> 6) & 0x3f)));
+			out.append(char(0x80 | (c & 0x3f)));
+		}
+	}
+	out.append('"');
+}
+
+void VisRequestWriter::appendValue(const QVariant &value)
+{
+	switch (value.userType()) {
+	case QMetaType::Bool:
+		m_buffer.append(value.toBool() ? "true" : "false");
+		break;
+	case QMetaType::Int:
+	case QMetaType::Long:
+	case QMetaType::LongLong:
+	case QMetaType::Short: {
+		qlonglong n = value.toLongLong();
+		if (n < 0) {
+			m_buffer.append('-');
+			appendNumber(0ULL - (unsigned long long) n);
+		} else {
+			appendNumber(n);
+		}
+		break;
+	}
+	case QMetaType::UInt:
+	case QMetaType::ULong:
+	case QMetaType::ULongLong:
+	case QMetaType::UShort:
+		appendNumber(value.toULongLong());
+		break;
+	case QMetaType::Double:
+	case QMetaType::Float: {
+		double d = value.toDouble();
+		if (!std::isfinite(d)) {
+			// Not representable in JSON
+			m_buffer.append("null");
+			break;
+		}
+
+		// Use the shortest of 15 or 17 significant digits that
+		// round-trips, printf is used to avoid allocating.
+		char buf[32];
+		int len = snprintf(buf, sizeof(buf), "%.15g", d);
+		if (strtod(buf, nullptr) != d)
+			len = snprintf(buf, sizeof(buf), "%.17g", d);
+
+		// printf honors LC_NUMERIC, which Qt sets from the environment
+		char point = *localeconv()->decimal_point;
+		if (point != '.') {
+			for (int i = 0; i < len; i++) {
+				if (buf[i] == point)
+					buf[i] = '.';
+			}
+		}
+		m_buffer.append(buf, len);
+		break;
+	}
+	default:
+		appendString(value.toString());
+		break;
+	}
+}
+
+void VisRequestWriter::appendNumber(unsigned long long value)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	do {
+		*--p = char('0' + value % 10);
+		value /= 10;
+	} while (value);
+	m_buffer.append(p, int(buf + sizeof(buf) - p));
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_REQUEST_WRITER_H
+#define VIS_REQUEST_WRITER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+// Serializes outbound VIS requests straight into a reused buffer,
+// avoiding building a QVariantMap/QJsonDocument per request.
+
+class VisRequestWriter
+{
+public:
+	VisRequestWriter();
+
+	// The token is escaped once here rather than on every request
+	void setToken(const QString &token);
+
+	// Returns a reference to the internal buffer holding the compact
+	// JSON request, which is only valid until the next call.  The
+	// value is only written if it is valid.  With redactToken set the
+	// token is replaced by a placeholder, e.g. for recordings.
+	const QByteArray &write(const QString &action,
+				unsigned int requestId,
+				const QString &path = QString(),
+				const QVariant &value = QVariant(),
+				bool redactToken = false);
+
+private:
+	void appendString(const QString &str);
+	void appendString(QByteArray &out, const QString &str);
+	void appendValue(const QVariant &value);
+	void appendNumber(unsigned long long value);
+
+	QByteArray m_buffer;
+	QByteArray m_token;
+};
+
+#endif // VIS_REQUEST_WRITER_H
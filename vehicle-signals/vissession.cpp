@@ -0,0 +1,833 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QThread>
+#include <QRandomGenerator>
+
+#include "vissession.h"
+#include "vismessageparser.h"
+#include "vistransport.h"
+
+// Reconnect backoff, doubling from the base delay up to the maximum
+#define RECONNECT_BASE_DELAY	500
+#define RECONNECT_MAX_DELAY	30000
+
+// NOTE: Sessions are expected to be created and used from a single
+//       (typically the GUI) thread, as is the case for the
+//       VehicleSignals objects using them.
+QHash<QString, QWeakPointer<VisSession>> VisSession::s_sessions;
+
+QSharedPointer<VisSession> VisSession::acquire(const VehicleSignalsConfig &config)
+{
+	VehicleSignalsConfig tmp(config);
+	QString key = tmp.key();
+
+	QSharedPointer<VisSession> session = s_sessions.value(key).toStrongRef();
+	if (!session) {
+		// Deleting via deleteLater avoids destroying the session
+		// from underneath itself if the last client goes away in
+		// a callback.
+		session = QSharedPointer<VisSession>(new VisSession(config), &QObject::deleteLater);
+		s_sessions.insert(key, session);
+	}
+	return session;
+}
+
+VisSession::VisSession(const VehicleSignalsConfig &config, QObject *parent) :
+	QObject(parent),
+	m_config(config),
+	m_verbose(0),
+	m_transport(nullptr),
+	m_thread(nullptr),
+	m_request_id(1),
+	m_state(Unconnected),
+	m_auth_requested(false),
+	m_reconnect_attempts(0),
+	m_lost_at(-1),
+	m_awaiting_notification(false),
+	m_loading(false),
+	m_request_timer_deadline(-1)
+{
+	m_key = m_config.key();
+
+	m_clock.start();
+	m_request_timer.setSingleShot(true);
+	QObject::connect(&m_request_timer, &QTimer::timeout, this, &VisSession::onRequestTimeout);
+	m_batch_timer.setSingleShot(true);
+	m_batch_timer.setInterval(0);
+	QObject::connect(&m_batch_timer, &QTimer::timeout, this, &VisSession::flushBatch);
+	m_reconnect_timer.setSingleShot(true);
+	QObject::connect(&m_reconnect_timer, &QTimer::timeout, this, &VisSession::reconnect);
+}
+
+void VisSession::createTransport()
+{
+	// When threaded, the transport hands over decoded messages in
+	// batches, and the connections below are queued.
+	m_transport = VisTransport::create(m_config);
+	QObject::connect(m_transport, &VisTransport::connected, this, &VisSession::onConnected);
+	QObject::connect(m_transport, &VisTransport::errorOccurred, this, &VisSession::onError);
+	QObject::connect(m_transport, &VisTransport::disconnected, this, &VisSession::onDisconnected);
+	QObject::connect(m_transport, &VisTransport::messagesReceived, this, &VisSession::onMessagesReceived);
+
+	// The gRPC transport makes blocking calls, so it always gets a
+	// worker thread to keep them off the caller's thread.
+	if (m_config.threaded() || m_config.transport() == "grpc") {
+		m_thread = new QThread();
+		m_thread->setObjectName(QStringLiteral("vis-transport"));
+		m_transport->moveToThread(m_thread);
+		// Destroy the transport in its own thread on shutdown
+		QObject::connect(m_thread, &QThread::finished, m_transport, &QObject::deleteLater);
+		m_thread->start();
+	}
+}
+
+VisSession::~VisSession()
+{
+	// A replacement session may already have been registered
+	if (s_sessions.value(m_key).isNull())
+		s_sessions.remove(m_key);
+
+	if (!m_transport)
+		return;
+
+	QObject::disconnect(m_transport, nullptr, this, nullptr);
+	if (m_thread) {
+		m_thread->quit();
+		m_thread->wait();
+		delete m_thread;
+	} else {
+		delete m_transport;
+	}
+}
+
+void VisSession::attach(VehicleSignals *client)
+{
+	m_clients.append(client);
+}
+
+void VisSession::detach(VehicleSignals *client)
+{
+	m_clients.removeAll(client);
+
+	for (auto &entry : m_paths)
+		entry.subscribers.removeAll(client);
+
+	// Drop the client's outstanding requests, their callbacks are
+	// likely bound to objects going away along with it.
+	for (auto it = m_pending.begin(); it != m_pending.end();) {
+		if (it.value().client == client)
+			it = m_pending.erase(it);
+		else
+			++it;
+	}
+
+	for (auto &request : m_batch) {
+		if (request.client == client)
+			request.client = nullptr;
+	}
+}
+
+void VisSession::open(VehicleSignals *client)
+{
+	if (!m_config.isLoaded()) {
+		// Clients are all told once connected
+		if (!m_loading) {
+			m_loading = true;
+			m_config.whenLoaded(this, [this]() {
+				m_loading = false;
+				open(nullptr);
+			});
+		}
+		return;
+	}
+
+	if (!m_config.valid()) {
+		qCritical() << "Invalid VIS server configuration";
+		return;
+	}
+
+	if (!m_transport) {
+		m_verbose = m_config.verbose();
+		createTransport();
+	}
+
+	if (m_state >= Connected) {
+		// Already up, let the new client know without re-entering it
+		QPointer<VehicleSignals> target(client);
+		QTimer::singleShot(0, this, [target]() {
+			if (target)
+				emit target->connected();
+		});
+		return;
+	}
+
+	// A pending reconnect will let this client know as well
+	if (m_state == Unconnected && !m_reconnect_timer.isActive())
+		openTransport();
+}
+
+void VisSession::openTransport()
+{
+	m_state = Connecting;
+	VisTransport *transport = m_transport;
+	QMetaObject::invokeMethod(transport, [transport]() {
+		transport->open();
+	});
+}
+
+void VisSession::onConnected()
+{
+	if (m_verbose > 1)
+		qDebug() << "VisSession::onConnected: enter";
+	m_state = Connected;
+
+	// Requests from the previous connection were failed when it was
+	// lost.  Anything sent since may already be on this one (e.g. with
+	// a threaded transport), so it is left to complete or time out.
+
+	// Replay authorization before telling clients, so that their own
+	// authorize() calls find it in progress.
+	if (m_auth_requested)
+		sendAuthorize();
+	else
+		onReady();
+
+	QList<QPointer<VehicleSignals>> clients = m_clients;
+	for (auto client : clients) {
+		if (client)
+			emit client->connected();
+	}
+}
+
+void VisSession::onError(QString errorString, bool unconnected)
+{
+	if (m_verbose > 1)
+		qDebug() << "VisSession::onError: enter" << errorString;
+
+	// A failed connection attempt may not be followed by a
+	// disconnect, errors on an established connection are.
+	if (unconnected && m_state == Connecting) {
+		m_state = Unconnected;
+		scheduleReconnect();
+	}
+}
+
+void VisSession::scheduleReconnect()
+{
+	// Only ever one reconnect in flight
+	if (m_state != Unconnected || m_reconnect_timer.isActive())
+		return;
+
+	int delay = qMin(RECONNECT_MAX_DELAY, RECONNECT_BASE_DELAY << qMin(m_reconnect_attempts, 16));
+	// Randomize half the delay, so that clients restarted along with
+	// the server do not all reconnect in lockstep.
+	delay = delay / 2 + int(QRandomGenerator::global()->bounded(delay / 2 + 1));
+	m_reconnect_attempts++;
+
+	if (m_verbose)
+		qInfo() << "Reconnecting to VIS server in" << delay << "ms";
+	m_reconnect_timer.start(delay);
+}
+
+void VisSession::reconnect()
+{
+	if (m_verbose > 1)
+		qDebug() << "VisSession::reconnect: enter";
+	if (m_state == Unconnected)
+		openTransport();
+}
+
+void VisSession::onDisconnected()
+{
+	if (m_verbose > 1)
+		qDebug() << "VisSession::onDisconnected: enter";
+
+	if (m_state >= Connected) {
+		// Recovery time is measured from the first loss, across
+		// any failed attempts in between.
+		if (m_lost_at < 0 || m_awaiting_notification)
+			m_lost_at = m_clock.elapsed();
+		m_awaiting_notification = false;
+	}
+	m_state = Unconnected;
+
+	for (auto &entry : m_paths) {
+		// Cached values can no longer be trusted to be current
+		entry.subscribed = false;
+		entry.received = -1;
+	}
+
+	// Queued requests fail along with the ones already sent
+	m_batch_timer.stop();
+	QList<BatchedRequest> batch;
+	batch.swap(m_batch);
+	m_batch_index.clear();
+	for (const auto &request : batch)
+		addPending(request.client, request.action, request.path, nullptr, VIS_REQUEST_TIMEOUT);
+	failPendingRequests(QStringLiteral("disconnected"));
+
+	QList<QPointer<VehicleSignals>> clients = m_clients;
+	for (auto client : clients) {
+		if (client)
+			emit client->disconnected();
+	}
+
+	scheduleReconnect();
+}
+
+void VisSession::authorize(VehicleSignals *client)
+{
+	m_auth_requested = true;
+
+	if (m_state == Authorized) {
+		QPointer<VehicleSignals> target(client);
+		QTimer::singleShot(0, this, [target]() {
+			if (target)
+				emit target->authorized();
+		});
+		return;
+	}
+
+	// All clients are told once the pending authorization completes,
+	// or once connected if not yet.
+	if (m_state != Connected)
+		return;
+
+	sendAuthorize();
+}
+
+void VisSession::sendAuthorize()
+{
+	m_state = Authorizing;
+	sendRequest(nullptr, QStringLiteral("authorize"), QString(), QVariant(), nullptr, VIS_REQUEST_TIMEOUT);
+}
+
+void VisSession::onReady()
+{
+	m_reconnect_attempts = 0;
+	replaySubscriptions();
+
+	if (m_lost_at >= 0 && !m_awaiting_notification) {
+		m_stats.reconnects++;
+		m_stats.lastReconnectTime = m_clock.elapsed() - m_lost_at;
+		m_stats.lastFirstNotificationTime = -1;
+		m_awaiting_notification = true;
+		if (m_verbose)
+			qInfo() << "VIS connection recovered in" << m_stats.lastReconnectTime << "ms";
+	}
+}
+
+void VisSession::replaySubscriptions()
+{
+	for (auto &entry : m_paths) {
+		if (entry.subscribed)
+			continue;
+		for (const auto &client : entry.subscribers) {
+			if (client) {
+				entry.subscribed = true;
+				queueRequest(client, QStringLiteral("subscribe"), entry.path);
+				break;
+			}
+		}
+	}
+}
+
+unsigned int VisSession::get(VehicleSignals *client, const QString &path, VehicleSignalsCallback callback, int timeout, int maxAge)
+{
+	// While subscribed, every change is pushed to us, so the cached
+	// value is current and a round trip can be avoided.
+	auto it = m_path_ids.constFind(path);
+	if (maxAge != 0 && it != m_path_ids.cend()) {
+		const PathEntry &entry = m_paths[it.value()];
+		qint64 age = m_clock.elapsed() - entry.received;
+		if (entry.subscribed && entry.received >= 0 && (maxAge < 0 || age <= maxAge)) {
+			if (m_verbose > 1)
+				qDebug() << "VisSession: serving get of" << path << "from cache, age" << age << "ms";
+
+			VehicleSignalsResponse response;
+			response.action = QStringLiteral("get");
+			response.success = true;
+			response.path = path;
+			response.value = entry.value;
+			response.timestamp = entry.timestamp;
+
+			// Keep delivery asynchronous as with a real reply
+			QPointer<VehicleSignals> target(client);
+			QTimer::singleShot(0, this, [target, callback, response]() {
+				if (!target)
+					return;
+				emit target->getSuccessResponse(response.path, response.value, response.timestamp);
+				if (callback)
+					callback(response);
+			});
+			return 0;
+		}
+	}
+
+	return sendRequest(client, QStringLiteral("get"), path, QVariant(), callback, timeout);
+}
+
+unsigned int VisSession::set(VehicleSignals *client, const QString &path, const QVariant &value, VehicleSignalsCallback callback, int timeout)
+{
+	return sendRequest(client, QStringLiteral("set"), path, value, callback, timeout);
+}
+
+unsigned int VisSession::subscribe(VehicleSignals *client, const QString &path, VehicleSignalsCallback callback, int timeout)
+{
+	int id = pathId(path);
+	addSubscriber(client, id);
+
+	if (m_state < Connected) {
+		// Sent by replaySubscriptions once connected
+		if (callback) {
+			QTimer::singleShot(0, client, [callback, path]() {
+				VehicleSignalsResponse response;
+				response.action = QStringLiteral("subscribe");
+				response.error = QStringLiteral("disconnected");
+				response.path = path;
+				callback(response);
+			});
+		}
+		return 0;
+	}
+
+	if (m_paths[id].subscribed) {
+		// Another client has already subscribed on this connection,
+		// there is nothing to send.
+		if (callback) {
+			QTimer::singleShot(0, client, [callback, path]() {
+				VehicleSignalsResponse response;
+				response.action = QStringLiteral("subscribe");
+				response.success = true;
+				response.path = path;
+				callback(response);
+			});
+		}
+		return 0;
+	}
+
+	m_paths[id].subscribed = true;
+	return sendRequest(client, QStringLiteral("subscribe"), path, QVariant(), callback, timeout);
+}
+
+void VisSession::queueGet(VehicleSignals *client, const QString &path)
+{
+	queueRequest(client, QStringLiteral("get"), path);
+}
+
+void VisSession::queueSet(VehicleSignals *client, const QString &path, const QVariant &value)
+{
+	queueRequest(client, QStringLiteral("set"), path, value);
+}
+
+void VisSession::queueSubscribe(VehicleSignals *client, const QString &path)
+{
+	int id = pathId(path);
+	addSubscriber(client, id);
+	// Not connected yet, replaySubscriptions sends it once connected
+	if (m_paths[id].subscribed || m_state < Connected)
+		return;
+
+	m_paths[id].subscribed = true;
+	queueRequest(client, QStringLiteral("subscribe"), path);
+}
+
+bool VisSession::addSubscriber(VehicleSignals *client, int id)
+{
+	QVector<QPointer<VehicleSignals>> &subscribers = m_paths[id].subscribers;
+	if (subscribers.contains(client))
+		return false;
+	subscribers.append(client);
+	return true;
+}
+
+void VisSession::queueRequest(VehicleSignals *client, const QString &action, const QString &path, const QVariant &value)
+{
+	// Gets are answered to the client that asked, so only merge
+	// duplicate gets from the same client.
+	QString key = action + QLatin1Char(':') + path;
+	if (action == "get")
+		key += QLatin1Char(':') + QString::number(quintptr(client));
+
+	auto it = m_batch_index.constFind(key);
+	if (it != m_batch_index.cend()) {
+		// Only the latest value of a set is of interest, and
+		// duplicate gets/subscribes would just get duplicate replies.
+		m_batch[it.value()].value = value;
+		return;
+	}
+
+	BatchedRequest request;
+	request.action = action;
+	request.path = path;
+	request.value = value;
+	request.client = client;
+	m_batch_index.insert(key, m_batch.size());
+	m_batch.append(request);
+
+	if (!m_batch_timer.isActive())
+		m_batch_timer.start();
+}
+
+void VisSession::flushBatch()
+{
+	// NOTE: The KUKSA.val VIS protocol has no envelope for carrying
+	//       multiple requests in one message, so each request still
+	//       needs its own frame.  Writing them out back to back
+	//       followed by a single flush at least lets them share
+	//       socket writes.
+	QList<BatchedRequest> batch;
+	batch.swap(m_batch);
+	m_batch_index.clear();
+
+	for (const auto &request : batch)
+		sendRequest(request.client, request.action, request.path, request.value, nullptr, VIS_REQUEST_TIMEOUT);
+
+	if (m_verbose > 1)
+		qDebug() << "VisSession::flushBatch: sent" << batch.size() << "requests";
+	VisTransport *transport = m_transport;
+	if (!transport)
+		return;
+	QMetaObject::invokeMethod(transport, [transport]() {
+		transport->flush();
+	});
+}
+
+int VisSession::pathId(const QString &path)
+{
+	auto it = m_path_ids.constFind(path);
+	if (it != m_path_ids.cend())
+		return it.value();
+
+	int id = m_paths.size();
+	PathEntry entry;
+	entry.path = path;
+	entry.subscribed = false;
+	entry.received = -1;
+	m_paths.append(entry);
+	m_path_ids.insert(path, id);
+	return id;
+}
+
+bool VisSession::cachedValue(const QString &path, QVariant &value, QString &timestamp, qint64 *age)
+{
+	auto it = m_path_ids.constFind(path);
+	if (it == m_path_ids.cend())
+		return false;
+
+	const PathEntry &entry = m_paths[it.value()];
+	if (entry.received < 0)
+		return false;
+
+	value = entry.value;
+	timestamp = entry.timestamp;
+	if (age)
+		*age = m_clock.elapsed() - entry.received;
+	return true;
+}
+
+void VisSession::updateCache(const QString &path, const QVariant &value, const QString &timestamp)
+{
+	auto it = m_path_ids.constFind(path);
+	if (it == m_path_ids.cend())
+		return;
+
+	PathEntry &entry = m_paths[it.value()];
+	entry.value = value;
+	entry.timestamp = timestamp;
+	entry.received = m_clock.elapsed();
+}
+
+void VisSession::dispatchNotification(const QString &path, const QVariant &value, const QString &timestamp)
+{
+	auto it = m_path_ids.constFind(path);
+	if (it == m_path_ids.cend())
+		return;
+
+	int id = it.value();
+	PathEntry &entry = m_paths[id];
+	entry.value = value;
+	entry.timestamp = timestamp;
+	entry.received = m_clock.elapsed();
+
+	if (m_awaiting_notification) {
+		m_stats.lastFirstNotificationTime = entry.received - m_lost_at;
+		m_awaiting_notification = false;
+		m_lost_at = -1;
+		if (m_verbose)
+			qInfo() << "First VIS notification after reconnect in"
+				<< m_stats.lastFirstNotificationTime << "ms";
+	}
+
+	// Work on a (shared) copy, delivery may add or remove subscribers
+	QVector<QPointer<VehicleSignals>> subscribers = m_paths[id].subscribers;
+	for (auto client : subscribers) {
+		if (client)
+			client->deliverNotification(id, path, value, timestamp);
+	}
+}
+
+unsigned int VisSession::sendRequest(VehicleSignals *client,
+				     const QString &action,
+				     const QString &path,
+				     const QVariant &value,
+				     VehicleSignalsCallback callback,
+				     int timeout)
+{
+	unsigned int id = addPending(client, action, path, callback, timeout);
+
+	// Without a transport yet (i.e. before connecting), the request
+	// goes nowhere and times out, as it would on an unconnected socket.
+	VisTransport *transport = m_transport;
+	if (!transport)
+		return id;
+	QMetaObject::invokeMethod(transport, [transport, action, id, path, value]() {
+		transport->sendRequest(action, id, path, value);
+	});
+
+	return id;
+}
+
+unsigned int VisSession::addPending(VehicleSignals *client,
+				    const QString &action,
+				    const QString &path,
+				    VehicleSignalsCallback callback,
+				    int timeout)
+{
+	unsigned int id = m_request_id++;
+	if (!m_request_id)
+		m_request_id = 1;
+
+	// Requests are tracked even without a callback so that replies
+	// can be logged against their path and latency measured.
+	PendingRequest pending;
+	pending.action = action;
+	pending.path = path;
+	pending.client = client;
+	pending.callback = callback;
+	pending.sent = m_clock.elapsed();
+	pending.deadline = pending.sent + (timeout > 0 ? timeout : VIS_REQUEST_TIMEOUT);
+	m_pending.insert(id, pending);
+	armRequestTimer(pending.deadline);
+
+	return id;
+}
+
+void VisSession::completeRequest(unsigned int id, VehicleSignalsResponse &response)
+{
+	auto it = m_pending.find(id);
+	if (it == m_pending.end())
+		return;
+
+	PendingRequest pending = it.value();
+	m_pending.erase(it);
+
+	response.requestId = id;
+	response.action = pending.action;
+	if (response.path.isEmpty())
+		response.path = pending.path;
+	response.latency = m_clock.elapsed() - pending.sent;
+
+	if (m_verbose > 1)
+		qDebug() << "VisSession: request" << id << pending.action << pending.path
+			 << (response.success ? "completed" : "failed") << "in" << response.latency << "ms";
+
+	if (pending.action == "authorize") {
+		if (m_state == Authorizing)
+			m_state = Connected;
+	} else if (pending.action == "subscribe" && !response.success) {
+		// Allow a later subscribe to retry
+		auto path = m_path_ids.constFind(pending.path);
+		if (path != m_path_ids.cend())
+			m_paths[path.value()].subscribed = false;
+	}
+
+	if (pending.callback)
+		pending.callback(response);
+}
+
+void VisSession::failPendingRequests(const QString &error)
+{
+	// Completing a request may run a callback that issues new
+	// requests, so work from a snapshot of the current ids.
+	QList<unsigned int> ids = m_pending.keys();
+	for (auto id : ids) {
+		VehicleSignalsResponse response;
+		response.error = error;
+		completeRequest(id, response);
+	}
+}
+
+void VisSession::armRequestTimer(qint64 deadline)
+{
+	if (m_request_timer.isActive() && m_request_timer_deadline <= deadline)
+		return;
+
+	m_request_timer_deadline = deadline;
+	m_request_timer.start(static_cast<int>(qMax<qint64>(deadline - m_clock.elapsed(), 0)));
+}
+
+void VisSession::onRequestTimeout()
+{
+	qint64 now = m_clock.elapsed();
+	qint64 next = -1;
+
+	QList<unsigned int> expired;
+	for (auto it = m_pending.cbegin(); it != m_pending.cend(); ++it) {
+		if (it.value().deadline <= now)
+			expired.append(it.key());
+		else if (next < 0 || it.value().deadline < next)
+			next = it.value().deadline;
+	}
+
+	for (auto id : expired) {
+		if (m_pending.contains(id))
+			qWarning() << "VIS" << m_pending.value(id).action << "request" << id << "timed out";
+		VehicleSignalsResponse response;
+		response.error = QStringLiteral("timeout");
+		completeRequest(id, response);
+	}
+
+	// Callbacks may have already re-armed the timer for a newer
+	// request, armRequestTimer keeps whichever deadline is earlier.
+	if (next >= 0)
+		armRequestTimer(next);
+}
+
+bool VisSession::parseData(const VisMessage &message, QString &path, QVariant &value, QString &timestamp)
+{
+	if (message.hasError)
+		return false;
+
+	if (!message.hasData) {
+		qWarning() << "Malformed response (data missing)";
+		return false;
+	}
+	if (!message.hasPath) {
+		qWarning() << "Malformed response (path missing)";
+		return false;
+	}
+	// Already normalized to '.' separators by the transport
+	path = message.path;
+
+	if (!message.hasDatapoint) {
+		qWarning() << "Malformed response (datapoint missing)";
+		return false;
+	}
+	if (!message.hasValue) {
+		qWarning() << "Malformed response (value missing)";
+		return false;
+	}
+	if (!message.value.isValid()) {
+		qWarning() << "Malformed response (unsupported value type)";
+		return false;
+	}
+	value = message.value;
+
+	if (!message.hasTimestamp) {
+		qWarning() << "Malformed response (timestamp missing)";
+		return false;
+	}
+	timestamp = message.timestamp;
+
+	return true;
+}
+
+//
+// NOTE:
+//
+// Replies are matched to the originating request via the request id
+// and the pending request table.  Subscription notifications carry
+// no usable request id and are dispatched by path to the clients
+// that subscribed to it.
+//
+void VisSession::onMessagesReceived(QVector<VisMessage> messages)
+{
+	// Messages are parsed and checked for an action by the transport
+	for (const auto &message : messages)
+		handleMessage(message);
+}
+
+void VisSession::handleMessage(const VisMessage &message)
+{
+	const QString &action = message.action;
+	if (action == "subscription") {
+		QString path, ts;
+		QVariant value;
+		if (parseData(message, path, value, ts)) {
+			if (m_verbose > 1)
+				qDebug() << "VisSession::onTextMessageReceived: dispatching notification" << path << " = " << value;
+			dispatchNotification(path, value, ts);
+		}
+		return;
+	}
+
+	// Everything else is a reply to one of our requests
+	unsigned int id = message.requestId;
+	if (!message.hasRequestId)
+		qWarning() << "VIS" << action << "reply without valid request id";
+
+	VehicleSignalsResponse response;
+	if (message.hasError) {
+		response.error = message.error;
+		QString path = message.hasRequestId ? m_pending.value(id).path : QString();
+		if (path.isEmpty())
+			qWarning() << "VIS" << action << "failed: " << response.error;
+		else
+			qWarning() << "VIS" << action << "of" << path << "failed: " << response.error;
+	} else {
+		response.success = true;
+	}
+
+	if (action == "authorize") {
+		if (response.success) {
+			if (m_verbose > 1)
+				qDebug() << "authorized";
+			m_state = Authorized;
+			onReady();
+
+			QList<QPointer<VehicleSignals>> clients = m_clients;
+			for (auto client : clients) {
+				if (client)
+					emit client->authorized();
+			}
+		}
+	} else if (action == "get") {
+		if (response.success) {
+			response.success = parseData(message, response.path, response.value, response.timestamp);
+			if (response.success) {
+				updateCache(response.path, response.value, response.timestamp);
+
+				// Only the client that asked gets the response
+				QPointer<VehicleSignals> client = m_pending.value(id).client;
+				if (m_verbose > 1)
+					qDebug() << "VisSession::onTextMessageReceived: emitting response" << response.path << " = " << response.value;
+				if (client)
+					emit client->getSuccessResponse(response.path, response.value, response.timestamp);
+			} else {
+				response.error = QStringLiteral("malformed response");
+			}
+		}
+	} else if (action != "subscribe" && action != "set") {
+		qWarning() << "unhandled VIS response of type: " << action;
+		return;
+	}
+
+	if (message.hasRequestId)
+		completeRequest(id, response);
+}
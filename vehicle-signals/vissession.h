@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_SESSION_H
+#define VIS_SESSION_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "vehiclesignals.h"
+#include "vismessageparser.h"
+
+class QThread;
+class VisTransport;
+
+// Connection to a VIS server shared by all VehicleSignals objects in
+// the process using the same server and credentials.  The session owns
+// the websocket, authorizes once, sends each subscription once, and
+// routes replies and notifications back to the VehicleSignals objects
+// (clients) that asked for them.  The connection itself is handled by
+// a VisTransport, optionally running in a worker thread.
+
+class VisSession : public QObject
+{
+	Q_OBJECT
+
+public:
+	// Returns the session matching config, creating it if required.
+	// The session is closed once the last reference is dropped.
+	static QSharedPointer<VisSession> acquire(const VehicleSignalsConfig &config);
+
+	virtual ~VisSession();
+
+	void attach(VehicleSignals *client);
+	void detach(VehicleSignals *client);
+
+	void open(VehicleSignals *client);
+	void authorize(VehicleSignals *client);
+
+	unsigned int get(VehicleSignals *client,
+			 const QString &path,
+			 VehicleSignalsCallback callback,
+			 int timeout,
+			 int maxAge);
+	unsigned int set(VehicleSignals *client,
+			 const QString &path,
+			 const QVariant &value,
+			 VehicleSignalsCallback callback,
+			 int timeout);
+	unsigned int subscribe(VehicleSignals *client,
+			       const QString &path,
+			       VehicleSignalsCallback callback,
+			       int timeout);
+
+	void queueGet(VehicleSignals *client, const QString &path);
+	void queueSet(VehicleSignals *client, const QString &path, const QVariant &value);
+	void queueSubscribe(VehicleSignals *client, const QString &path);
+
+	int pathId(const QString &path);
+	bool cachedValue(const QString &path, QVariant &value, QString &timestamp, qint64 *age);
+	VehicleSignalsConnectionStats connectionStats() { return m_stats; };
+
+	unsigned verbose() { return m_verbose; };
+
+private slots:
+	void onConnected();
+	void onError(QString errorString, bool unconnected);
+	void reconnect();
+	void onDisconnected();
+	void onMessagesReceived(QVector<VisMessage> messages);
+	void onRequestTimeout();
+	void flushBatch();
+
+private:
+	explicit VisSession(const VehicleSignalsConfig &config, QObject *parent = Q_NULLPTR);
+
+	enum State {
+		Unconnected,	// possibly waiting to reconnect
+		Connecting,
+		Connected,
+		Authorizing,
+		Authorized
+	};
+
+	// Outstanding request, keyed by request id in m_pending
+	struct PendingRequest {
+		QString action;
+		QString path;
+		QPointer<VehicleSignals> client;
+		VehicleSignalsCallback callback;
+		qint64 sent;
+		qint64 deadline;
+	};
+
+	// Queued request, see queueGet/queueSet/queueSubscribe
+	struct BatchedRequest {
+		QString action;
+		QString path;
+		QVariant value;
+		QPointer<VehicleSignals> client;
+	};
+
+	// Interned path, indexed by path id in m_paths.  subscribed is
+	// set once a subscribe has been sent on the current connection.
+	// The last value seen is cached along with when it was received
+	// (m_clock time, -1 if there is no value for this connection).
+	struct PathEntry {
+		QString path;
+		QVector<QPointer<VehicleSignals>> subscribers;
+		bool subscribed;
+		QVariant value;
+		QString timestamp;
+		qint64 received;
+	};
+
+	static QHash<QString, QWeakPointer<VisSession>> s_sessions;
+
+	VehicleSignalsConfig m_config;
+	QString m_key;
+	// Cached from the config once loaded
+	unsigned m_verbose;
+	VisTransport *m_transport;
+	QThread *m_thread;
+	unsigned int m_request_id;
+
+	QList<QPointer<VehicleSignals>> m_clients;
+	State m_state;
+	// Set once a client has asked for authorization, which is then
+	// repeated on every new connection.
+	bool m_auth_requested;
+
+	QTimer m_reconnect_timer;
+	int m_reconnect_attempts;
+
+	// m_clock time the connection was lost, -1 when not recovering
+	qint64 m_lost_at;
+	bool m_awaiting_notification;
+	VehicleSignalsConnectionStats m_stats;
+	// Waiting for the config to be loaded to connect
+	bool m_loading;
+
+	QHash<unsigned int, PendingRequest> m_pending;
+	QElapsedTimer m_clock;
+	QTimer m_request_timer;
+	qint64 m_request_timer_deadline;
+
+	QHash<QString, int> m_path_ids;
+	QVector<PathEntry> m_paths;
+
+	QList<BatchedRequest> m_batch;
+	QHash<QString, int> m_batch_index;
+	QTimer m_batch_timer;
+
+	void createTransport();
+	void openTransport();
+	void scheduleReconnect();
+	void sendAuthorize();
+	void onReady();
+	void replaySubscriptions();
+	void handleMessage(const VisMessage &message);
+	bool addSubscriber(VehicleSignals *client, int id);
+
+	unsigned int sendRequest(VehicleSignals *client,
+				 const QString &action,
+				 const QString &path,
+				 const QVariant &value,
+				 VehicleSignalsCallback callback,
+				 int timeout);
+	// Tracks a request in m_pending without sending it
+	unsigned int addPending(VehicleSignals *client,
+				const QString &action,
+				const QString &path,
+				VehicleSignalsCallback callback,
+				int timeout);
+	void completeRequest(unsigned int id, VehicleSignalsResponse &response);
+	void failPendingRequests(const QString &error);
+	void armRequestTimer(qint64 deadline);
+	void queueRequest(VehicleSignals *client,
+			  const QString &action,
+			  const QString &path,
+			  const QVariant &value = QVariant());
+
+	void updateCache(const QString &path, const QVariant &value, const QString &timestamp);
+	void dispatchNotification(const QString &path, const QVariant &value, const QString &timestamp);
+	bool parseData(const VisMessage &message, QString &path, QVariant &value, QString &timestamp);
+};
+
+#endif // VIS_SESSION_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+
+#include "vistransport.h"
+#include "visrecorder.h"
+#include "viswebsockettransport.h"
+#ifdef HAVE_VIS_GRPC
+#include "visgrpctransport.h"
+#endif
+
+VisTransport *VisTransport::create(const VehicleSignalsConfig &config)
+{
+	VehicleSignalsConfig tmp(config);
+	if (tmp.transport() == "grpc") {
+#ifdef HAVE_VIS_GRPC
+		return new VisGrpcTransport(config);
+#else
+		qWarning() << "gRPC VIS transport not available, using websocket";
+#endif
+	} else if (tmp.transport() != "websocket" && tmp.transport() != "websocket-plain") {
+		qWarning() << "Unknown VIS transport" << tmp.transport() << ", using websocket";
+	}
+	return new VisWebSocketTransport(config);
+}
+
+VisTransport::VisTransport(const VehicleSignalsConfig &config, QObject *parent) :
+	QObject(parent),
+	m_config(config),
+	// Parented so that it follows the transport to a worker thread
+	m_flush_timer(this),
+	m_recorder(Q_NULLPTR)
+{
+	qRegisterMetaType<QVector<VisMessage>>();
+
+	m_batched = m_config.threaded();
+	m_flush_timer.setSingleShot(true);
+	m_flush_timer.setInterval(0);
+	QObject::connect(&m_flush_timer, &QTimer::timeout, this, &VisTransport::flushMessages);
+
+	QString recordFile = m_config.recordFile();
+	if (!recordFile.isEmpty()) {
+		m_recorder = new VisRecorder;
+		if (!m_recorder->open(recordFile)) {
+			delete m_recorder;
+			m_recorder = Q_NULLPTR;
+		}
+	}
+}
+
+VisTransport::~VisTransport()
+{
+	delete m_recorder;
+}
+
+void VisTransport::record(bool outbound, const QByteArray &frame)
+{
+	if (m_recorder)
+		m_recorder->record(outbound, frame);
+}
+
+void VisTransport::flushRecording()
+{
+	if (m_recorder)
+		m_recorder->flush();
+}
+
+void VisTransport::receiveMessage(const VisMessage &message)
+{
+	if (!m_batched) {
+		emit messagesReceived(QVector<VisMessage>{ message });
+		return;
+	}
+
+	m_messages.append(message);
+	if (!m_flush_timer.isActive())
+		m_flush_timer.start();
+}
+
+void VisTransport::flushMessages()
+{
+	m_flush_timer.stop();
+	if (m_messages.isEmpty())
+		return;
+
+	if (m_config.verbose() > 1)
+		qDebug() << "VisTransport: handing over" << m_messages.size() << "messages";
+
+	QVector<VisMessage> messages;
+	messages.swap(m_messages);
+	emit messagesReceived(messages);
+}
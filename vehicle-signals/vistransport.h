@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_TRANSPORT_H
+#define VIS_TRANSPORT_H
+
+#include <QObject>
+#include <QVector>
+#include <QTimer>
+
+#include "vehiclesignals.h"
+#include "vismessageparser.h"
+
+class VisRecorder;
+
+// Connection to the VIS server.  A transport takes requests from the
+// session and hands back replies and notifications decoded into
+// VisMessage form, so the session does not depend on the wire format.
+//
+// The transport may be moved to a worker thread, in which case its
+// methods must be invoked in that thread and decoded messages are
+// handed back in batches, one per event loop iteration of the worker.
+
+class VisTransport : public QObject
+{
+	Q_OBJECT
+
+public:
+	// Creates the transport selected by config.transport()
+	static VisTransport *create(const VehicleSignalsConfig &config);
+
+	virtual ~VisTransport();
+
+	virtual void open() = 0;
+	virtual void close() = 0;
+	virtual void sendRequest(const QString &action,
+				 unsigned int requestId,
+				 const QString &path,
+				 const QVariant &value) = 0;
+	virtual void flush() {};
+
+signals:
+	void connected();
+	void disconnected();
+	void errorOccurred(QString errorString, bool unconnected);
+	void messagesReceived(QVector<VisMessage> messages);
+
+protected:
+	explicit VisTransport(const VehicleSignalsConfig &config, QObject *parent = Q_NULLPTR);
+
+	// Queue a decoded message for the session
+	void receiveMessage(const VisMessage &message);
+
+	// Record a frame if enabled by config.recordFile()
+	bool recording() const { return m_recorder != Q_NULLPTR; };
+	void record(bool outbound, const QByteArray &frame);
+	void flushRecording();
+
+	VehicleSignalsConfig m_config;
+
+protected slots:
+	void flushMessages();
+
+private:
+	bool m_batched;
+	QVector<VisMessage> m_messages;
+	QTimer m_flush_timer;
+	VisRecorder *m_recorder;
+};
+
+#endif // VIS_TRANSPORT_H
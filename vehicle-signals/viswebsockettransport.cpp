@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <QDebug>
+#include <QUrl>
+#include <QSslKey>
+
+#include "viswebsockettransport.h"
+
+VisWebSocketTransport::VisWebSocketTransport(const VehicleSignalsConfig &config, QObject *parent) :
+	VisTransport(config, parent),
+	// Parented so that it follows the transport to a worker thread
+	m_websocket(QString(), QWebSocketProtocol::VersionLatest, this),
+	m_secure(m_config.transport() != "websocket-plain"),
+	m_ssl_config_valid(false)
+{
+	m_writer.setToken(m_config.authToken());
+
+	QObject::connect(&m_websocket, &QWebSocket::connected, this, &VisWebSocketTransport::onConnected);
+	QObject::connect(&m_websocket, &QWebSocket::disconnected, this, &VisWebSocketTransport::onDisconnected);
+	QObject::connect(&m_websocket, QOverload<QAbstractSocket::SocketError>::of(&QWebSocket::error),
+			 this, &VisWebSocketTransport::onError);
+	QObject::connect(&m_websocket, &QWebSocket::textMessageReceived,
+			 this, &VisWebSocketTransport::onTextMessageReceived);
+}
+
+VisWebSocketTransport::~VisWebSocketTransport()
+{
+	QObject::disconnect(&m_websocket, nullptr, this, nullptr);
+	m_websocket.close();
+}
+
+bool VisWebSocketTransport::buildSslConfiguration()
+{
+	// The PEM data is only parsed once, reconnects reuse the result
+	// along with the last TLS session ticket.
+	if (m_ssl_config_valid)
+		return true;
+
+	QSslConfiguration sslConfig = QSslConfiguration::defaultConfiguration();
+
+	// Add client private key
+        // i.e. kuksa_certificates/Client.key in source tree
+	QSslKey sslKey(m_config.clientKey(), QSsl::Rsa);
+	sslConfig.setPrivateKey(sslKey);
+
+	// Add local client certificate
+        // i.e. kuksa_certificates/Client.pem in source tree
+	QList<QSslCertificate> sslCerts = QSslCertificate::fromData(m_config.clientCert());
+	if (sslCerts.empty()) {
+		qCritical() << "Invalid client certificate";
+		return false;
+	}
+	sslConfig.setLocalCertificate(sslCerts.first());
+
+	// Add CA certificate
+        // i.e. kuksa_certificates/CA.pem in source tree
+	// Note the following can be simplified with QSslConfiguration::addCaCertificate with Qt 5.15
+	QList<QSslCertificate> sslCaCerts = sslConfig.caCertificates();
+	QList<QSslCertificate> newSslCaCerts = QSslCertificate::fromData(m_config.caCert());
+	if (newSslCaCerts.empty()) {
+		qCritical() << "Invalid CA certificate";
+		return false;
+	}
+	sslCaCerts.append(newSslCaCerts.first());
+	sslConfig.setCaCertificates(sslCaCerts);
+
+	sslConfig.setPeerVerifyMode(m_config.verifyPeer() ? QSslSocket::VerifyPeer : QSslSocket::VerifyNone);
+
+	// Allow session tickets to be retrieved for resumption, avoiding
+	// a full handshake when reconnecting.
+	sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+
+	m_ssl_config = sslConfig;
+	m_ssl_config_valid = true;
+	return true;
+}
+
+void VisWebSocketTransport::open()
+{
+	QUrl visUrl;
+	visUrl.setScheme(m_secure ? QStringLiteral("wss") : QStringLiteral("ws"));
+	visUrl.setHost(m_config.hostname());
+	visUrl.setPort(m_config.port());
+
+	if (m_secure) {
+		if (!buildSslConfiguration()) {
+			emit errorOccurred(QStringLiteral("invalid TLS configuration"), true);
+			return;
+		}
+		m_websocket.setSslConfiguration(m_ssl_config);
+	}
+	if (m_config.verbose())
+		qInfo() << "Opening VIS websocket";
+	m_websocket.open(visUrl);
+}
+
+void VisWebSocketTransport::close()
+{
+	m_websocket.close();
+}
+
+void VisWebSocketTransport::sendRequest(const QString &action,
+					unsigned int requestId,
+					const QString &path,
+					const QVariant &value)
+{
+	const QByteArray &request = m_writer.write(action, requestId, path, value);
+	m_websocket.sendTextMessage(QString::fromUtf8(request));
+
+	// Every request carries the bearer token, keep it out of the
+	// recording.  This reuses the writer's buffer, so comes last.
+	if (recording())
+		record(true, m_writer.write(action, requestId, path, value, true));
+}
+
+void VisWebSocketTransport::flush()
+{
+	m_websocket.flush();
+}
+
+void VisWebSocketTransport::onConnected()
+{
+	if (m_secure)
+		checkSessionTicket();
+	emit connected();
+}
+
+void VisWebSocketTransport::onDisconnected()
+{
+	// A TLS 1.3 ticket may only arrive after the handshake
+	if (m_secure)
+		checkSessionTicket();
+	flushRecording();
+
+	// Keep anything already decoded ahead of the disconnect
+	flushMessages();
+	emit disconnected();
+}
+
+void VisWebSocketTransport::checkSessionTicket()
+{
+	QByteArray ticket = m_websocket.sslConfiguration().sessionTicket();
+	if (ticket.isEmpty() || ticket == m_session_ticket)
+		return;
+
+	if (m_config.verbose() > 1)
+		qDebug() << "VisWebSocketTransport: caching TLS session ticket," << ticket.size() << "bytes";
+	m_session_ticket = ticket;
+	m_ssl_config.setSessionTicket(ticket);
+}
+
+void VisWebSocketTransport::onError(QAbstractSocket::SocketError error)
+{
+	Q_UNUSED(error);
+	emit errorOccurred(m_websocket.errorString(),
+			   m_websocket.state() == QAbstractSocket::UnconnectedState);
+}
+
+void VisWebSocketTransport::onTextMessageReceived(const QString &msg)
+{
+	if (recording())
+		record(false, msg.toUtf8());
+
+	VisMessage message;
+	if (!m_parser.parse(msg, message)) {
+		qWarning() << "Received invalid JSON: malformed VIS message";
+		return;
+	}
+
+	if (message.action.isEmpty()) {
+		qWarning() << "Received unknown message (no action), discarding";
+		return;
+	}
+
+	// Convert '/' to '.' in paths to ensure consistency for clients
+	if (message.hasPath)
+		message.path.replace(QLatin1Char('/'), QLatin1Char('.'));
+
+	receiveMessage(message);
+}
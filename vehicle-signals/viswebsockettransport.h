@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIS_WEBSOCKET_TRANSPORT_H
+#define VIS_WEBSOCKET_TRANSPORT_H
+
+#include <QWebSocket>
+#include <QSslConfiguration>
+
+#include "vistransport.h"
+#include "visrequestwriter.h"
+
+// KUKSA.val VIS v1 JSON over a secure websocket, or a plain one for
+// the "websocket-plain" transport.
+
+class VisWebSocketTransport : public VisTransport
+{
+	Q_OBJECT
+
+public:
+	explicit VisWebSocketTransport(const VehicleSignalsConfig &config, QObject *parent = Q_NULLPTR);
+	virtual ~VisWebSocketTransport();
+
+	void open() override;
+	void close() override;
+	void sendRequest(const QString &action,
+			 unsigned int requestId,
+			 const QString &path,
+			 const QVariant &value) override;
+	void flush() override;
+
+private slots:
+	void onConnected();
+	void onDisconnected();
+	void onError(QAbstractSocket::SocketError error);
+	void onTextMessageReceived(const QString &message);
+
+private:
+	QWebSocket m_websocket;
+	VisRequestWriter m_writer;
+	VisMessageParser m_parser;
+
+	bool m_secure;
+	QSslConfiguration m_ssl_config;
+	bool m_ssl_config_valid;
+	QByteArray m_session_ticket;
+
+	bool buildSslConfiguration();
+	void checkSessionTicket();
+};
+
+#endif // VIS_WEBSOCKET_TRANSPORT_H